@@ -1,10 +1,357 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
 #include "vg.hpp"
 
-int main() {
-  vg::Window window {"Test Window", 500, 500};
-  vg::Renderer renderer {window};
+static vg::Mesh createTriangle(vg::Renderer& renderer) {
+  const std::array<vg::Vertex, 3> vertices {{
+      {{0.0f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.5f, 0.0f}},
+      {{0.5f, 0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 1.0f}},
+      {{-0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
+  }};
+  const std::array<std::uint32_t, 3> indices {0, 1, 2};
+  return renderer.createMesh(vertices, indices);
+}
+
+static void printTimings(const vg::FrameTimer& timer) {
+  const auto row {[&](const char* name,
+                       std::chrono::nanoseconds vg::FrameTiming::*field) {
+    const auto us {[](std::chrono::nanoseconds ns) {
+      return std::chrono::duration<double, std::micro> {ns}.count();
+    }};
+    std::cout << name << " p50/p95/p99: " << us(timer.percentile(0.5, field))
+              << "/" << us(timer.percentile(0.95, field)) << "/"
+              << us(timer.percentile(0.99, field)) << "us\n";
+  }};
+
+  row("frame time", &vg::FrameTiming::frame_time);
+  row("wait", &vg::FrameTiming::wait);
+  row("record", &vg::FrameTiming::record);
+  row("submit", &vg::FrameTiming::submit);
+  row("gpu", &vg::FrameTiming::gpu);
+}
+
+static void printRunStats(const vg::RunStats& stats) {
+  const auto seconds {std::chrono::duration<double> {stats.wall}.count()};
+  std::cout << "frames: " << stats.frames << " in " << seconds << " s\n"
+            << "cpu: " << stats.utilization() * 100.0
+            << "% of wall time, all threads\n";
+}
+
+static int listDevices() {
+  const auto devices {vg::listDevices()};
+  for(size_t rank {0}; rank < devices.size(); rank++) {
+    const auto& info {devices[rank]};
+    std::cout << rank << ": [" << info.index << "] " << info.name << " ("
+              << vk::to_string(info.type) << ", " << (info.vram >> 20)
+              << " MiB)\n   uuid " << info.uuid;
+    if(info.unsuitable.empty())
+      std::cout << ", score " << info.score << "\n";
+    else
+      std::cout << ", unsuitable: " << info.unsuitable << "\n";
+  }
+  return devices.empty() ? 1 : 0;
+}
+
+static int runHeadless(vk::Extent2D extent, size_t frames,
+    const vg::RendererOptions& opts, const std::string& csv_path) {
+  vg::Renderer renderer {extent, opts};
+  const auto triangle {createTriangle(renderer)};
+
+  auto start {std::chrono::steady_clock::now()};
+  for(size_t i {0}; i < frames; i++) {
+    renderer.submit({.mesh {triangle}});
+    renderer.draw();
+  }
+  renderer.readPixels();
+  std::chrono::duration<double> elapsed {
+      std::chrono::steady_clock::now() - start};
+
+  std::cout << frames << " frames in " << elapsed.count() << "s ("
+            << frames / elapsed.count() << " fps)\n";
+  std::cout << "rendering: "
+            << (renderer.usesDynamicRendering() ? "dynamic" : "render pass")
+            << "\n";
+  printTimings(renderer.getFrameTimer());
+  if(!csv_path.empty()) {
+    std::ofstream csv {csv_path};
+    renderer.getFrameTimer().dumpCsv(csv);
+  }
+
+  const auto heaps {renderer.getMemoryStats()};
+  for(size_t i {0}; i < heaps.size(); i++)
+    std::cout << "heap " << i << ": " << heaps[i].used_bytes << "/"
+              << heaps[i].block_bytes << " bytes in "
+              << heaps[i].allocation_count << " allocations, "
+              << heaps[i].block_count << " blocks, utilization "
+              << heaps[i].utilization() << ", fragmentation "
+              << heaps[i].fragmentation() << "\n";
+
+  renderer.destroy();
+  return 0;
+}
+
+static int benchRecord(vk::Extent2D extent, size_t frames, size_t draws,
+    vg::RendererOptions opts) {
+  opts.pipeline_cache_path.clear();
+  vg::Renderer renderer {extent, opts};
+  const auto triangle {createTriangle(renderer)};
+  const size_t max_threads {
+      std::max<size_t>(std::thread::hardware_concurrency(), 1)};
+
+  std::cout << "threads,draws,record_us\n";
+  for(size_t threads {0}; threads <= max_threads; threads++) {
+    renderer.setRecordThreads(threads);
+
+    std::chrono::nanoseconds record_time {0};
+    for(size_t i {0}; i < frames; i++) {
+      for(size_t j {0}; j < draws; j++)
+        renderer.submit({.mesh {triangle}});
+      renderer.draw();
+      record_time += renderer.getFrameTimer().last().record;
+    }
+
+    std::chrono::duration<double, std::micro> record_us {record_time};
+    std::cout << threads << "," << draws << "," << record_us.count() / frames
+              << "\n";
+  }
+
+  renderer.destroy();
+  return 0;
+}
+
+static int benchDispatch(vk::Extent2D extent, size_t calls,
+    const vg::RendererOptions& opts) {
+  vg::Renderer renderer {extent, opts};
+  std::cout << "call,trampoline_ns,direct_ns,saved_ns\n";
+  for(const auto& cost : renderer.measureDispatch(calls))
+    std::cout << cost.call << "," << cost.trampoline_ns << ","
+              << cost.direct_ns << ","
+              << cost.trampoline_ns - cost.direct_ns << "\n";
+  renderer.destroy();
+  return 0;
+}
+
+static std::vector<vg::Instance> createGrid(size_t count) {
+  const auto side {static_cast<size_t>(std::ceil(std::sqrt(count)))};
+  const float scale {1.0f / side};
+  std::vector<vg::Instance> instances(count);
+  for(size_t i {0}; i < count; i++) {
+    const auto x {static_cast<float>(i % side)};
+    const auto y {static_cast<float>(i / side)};
+    auto& t {instances[i].transform};
+    t[0] = t[5] = scale;
+    t[12] = -1.0f + scale * (2.0f * x + 1.0f);
+    t[13] = -1.0f + scale * (2.0f * y + 1.0f);
+    instances[i].color = {x * scale, y * scale, 1.0f, 1.0f};
+  }
+  return instances;
+}
+
+static int benchInstancing(vk::Extent2D extent, size_t frames,
+    size_t count, vg::RendererOptions opts) {
+  opts.pipeline_cache_path.clear();
+  opts.instance_buffer_size = std::max<vk::DeviceSize>(
+      opts.instance_buffer_size, count * sizeof(vg::Instance));
+  vg::Renderer renderer {extent, opts};
+  const auto triangle {createTriangle(renderer)};
+  const auto instances {renderer.createInstances(createGrid(count))};
+
+  std::cout << "mode,instances,record_us,frame_us\n";
+  for(const bool instanced : {false, true}) {
+    std::chrono::nanoseconds record_time {0};
+    std::chrono::nanoseconds frame_time {0};
+    for(size_t i {0}; i < frames; i++) {
+      if(instanced)
+        renderer.submitInstanced(triangle, instances);
+      else
+        for(std::uint32_t j {0}; j < instances.count; j++)
+          renderer.submitInstanced(triangle, {instances.first + j, 1});
+      renderer.draw();
+      record_time += renderer.getFrameTimer().last().record;
+      frame_time += renderer.getFrameTimer().last().frame_time;
+    }
+
+    std::chrono::duration<double, std::micro> record_us {record_time};
+    std::chrono::duration<double, std::micro> frame_us {frame_time};
+    std::cout << (instanced ? "instanced" : "individual") << "," << count
+              << "," << record_us.count() / frames << ","
+              << frame_us.count() / frames << "\n";
+  }
+
+  renderer.destroy();
+  return 0;
+}
+
+static int benchCulling(vk::Extent2D extent, size_t frames, size_t count,
+    vg::RendererOptions opts) {
+  opts.pipeline_cache_path.clear();
+  opts.instance_buffer_size = std::max<vk::DeviceSize>(
+      opts.instance_buffer_size, count * sizeof(vg::Instance));
+  opts.max_objects =
+      std::max(opts.max_objects, static_cast<std::uint32_t>(count));
+  const auto grid {createGrid(count)};
+
+  std::cout << "mode,objects,record_us,gpu_us\n";
+  for(const bool gpu_driven : {false, true}) {
+    vg::Renderer renderer {extent, opts};
+    const auto triangle {createTriangle(renderer)};
+    const auto instances {renderer.createInstances(grid)};
+    std::vector<vg::Object> objects;
+    objects.reserve(grid.size());
+    for(const auto& instance : grid)
+      objects.push_back({
+          .mesh {triangle},
+          .instance {instance},
+          .bounds {0.0f, 0.0f, 0.0f, 0.71f},
+      });
+    renderer.addObjects(objects);
+    renderer.setViewProjection({2.0f, 0.0f, 0.0f, 0.0f, 0.0f, 2.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f});
+
+    std::chrono::nanoseconds record_time {0};
+    for(size_t i {0}; i < frames; i++) {
+      if(gpu_driven)
+        renderer.submitObjects();
+      else
+        for(std::uint32_t j {0}; j < instances.count; j++)
+          renderer.submitInstanced(triangle, {instances.first + j, 1});
+      renderer.draw();
+      record_time += renderer.getFrameTimer().last().record;
+    }
+
+    const auto& timer {renderer.getFrameTimer()};
+    std::chrono::duration<double, std::micro> record_us {record_time};
+    std::chrono::duration<double, std::micro> gpu_us {
+        timer.percentile(0.5, &vg::FrameTiming::gpu)};
+    std::cout << (gpu_driven ? "indirect" : "direct") << "," << count << ","
+              << record_us.count() / frames << "," << gpu_us.count() << "\n";
+    renderer.destroy();
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  bool headless {false};
+  bool on_demand {false};
+  double target_fps {0.0};
+  size_t frames {1000};
+  size_t bench_draws {0};
+  size_t bench_instances {0};
+  size_t bench_objects {0};
+  size_t bench_calls {0};
+  vk::Extent2D extent {500, 500};
+  vg::RendererOptions opts;
+  std::string csv_path;
+
+  for(int i {1}; i < argc; i++) {
+    std::string_view arg {argv[i]};
+    if(arg == "--headless")
+      headless = true;
+    else if(arg == "--list-devices")
+      return listDevices();
+    else if(arg == "--device" && i + 1 < argc)
+      opts.device = argv[++i];
+    else if(arg == "--on-demand")
+      on_demand = true;
+    else if(arg == "--fps" && i + 1 < argc)
+      target_fps = std::strtod(argv[++i], nullptr);
+    else if(arg == "--frames" && i + 1 < argc)
+      frames = std::strtoull(argv[++i], nullptr, 10);
+    else if(arg == "--size" && i + 2 < argc) {
+      extent.width = std::strtoul(argv[++i], nullptr, 10);
+      extent.height = std::strtoul(argv[++i], nullptr, 10);
+    } else if(arg == "--frames-in-flight" && i + 1 < argc)
+      opts.max_frames_in_flight = std::strtoull(argv[++i], nullptr, 10);
+    else if(arg == "--present" && i + 1 < argc) {
+      const std::string_view policy {argv[++i]};
+      if(policy == "low-latency")
+        opts.present_policy = vg::PresentPolicy::eLowLatency;
+      else if(policy == "power-saving")
+        opts.present_policy = vg::PresentPolicy::ePowerSaving;
+      else if(policy == "max-throughput")
+        opts.present_policy = vg::PresentPolicy::eMaxThroughput;
+      else {
+        std::cerr << "unknown present policy: " << policy << "\n";
+        return 1;
+      }
+    } else if(arg == "--validation")
+      opts.validation = true;
+    else if(arg == "--no-validation")
+      opts.validation = false;
+    else if(arg == "--no-dynamic-rendering")
+      opts.dynamic_rendering = false;
+    else if(arg == "--csv" && i + 1 < argc)
+      csv_path = argv[++i];
+    else if(arg == "--bench-record" && i + 1 < argc)
+      bench_draws = std::strtoull(argv[++i], nullptr, 10);
+    else if(arg == "--bench-instancing" && i + 1 < argc)
+      bench_instances = std::strtoull(argv[++i], nullptr, 10);
+    else if(arg == "--bench-culling" && i + 1 < argc)
+      bench_objects = std::strtoull(argv[++i], nullptr, 10);
+    else if(arg == "--bench-dispatch" && i + 1 < argc)
+      bench_calls = std::strtoull(argv[++i], nullptr, 10);
+    else {
+      std::cerr << "usage: " << argv[0]
+                << " [--list-devices] [--device INDEX|UUID|NAME]"
+                   " [--headless] [--on-demand] [--fps N]"
+                   " [--frames N] [--size W H]"
+                   " [--present low-latency|power-saving|max-throughput]"
+                   " [--frames-in-flight N] [--no-dynamic-rendering]"
+                   " [--[no-]validation]"
+                   " [--csv FILE]"
+                   " [--bench-record DRAWS]"
+                   " [--bench-instancing COUNT]"
+                   " [--bench-culling OBJECTS]"
+                   " [--bench-dispatch CALLS]\n";
+      return 1;
+    }
+  }
+
+  if(bench_draws)
+    return benchRecord(extent, frames, bench_draws, opts);
+  if(bench_instances)
+    return benchInstancing(extent, frames, bench_instances, opts);
+  if(bench_objects)
+    return benchCulling(extent, frames, bench_objects, opts);
+  if(bench_calls)
+    return benchDispatch(extent, bench_calls, opts);
+  if(headless)
+    return runHeadless(extent, frames, opts, csv_path);
+
+  vg::Window window {"Test Window",
+      static_cast<int>(extent.width), static_cast<int>(extent.height)};
+  vg::Renderer renderer {window, opts};
+  const auto triangle {createTriangle(renderer)};
+  std::cout << "present mode: " << vk::to_string(*renderer.getPresentMode())
+            << "\n";
+
+  const auto frame {[&]() {
+    renderer.submit({.mesh {triangle}});
+    renderer.draw();
+  }};
+  vg::RunStats stats;
+  if(on_demand)
+    stats = window.run_on_demand(frame);
+  else if(target_fps > 0.0)
+    stats = window.run_paced(target_fps, frame);
+  else
+    stats = window.run_continuous(frame);
 
-  window.run_continuous([&]() { renderer.draw(); });
+  printTimings(renderer.getFrameTimer());
+  printRunStats(stats);
+  if(!csv_path.empty()) {
+    std::ofstream csv {csv_path};
+    renderer.getFrameTimer().dumpCsv(csv);
+  }
 
   renderer.destroy();
   window.destroy();
@@ -1,10 +1,25 @@
 #version 460
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+layout(set = 0, binding = 0) uniform texture2D textures[];
+layout(set = 0, binding = 2) uniform sampler samplers[];
+
+layout(push_constant) uniform DrawPush {
+    uint texture_idx;
+    uint sampler_idx;
+    uint buffer_idx;
+} draw;
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    vec4 color = vec4(fragColor, 1.0);
+    if(draw.texture_idx != 0xFFFFFFFFu)
+        color *= texture(sampler2D(textures[nonuniformEXT(draw.texture_idx)],
+            samplers[nonuniformEXT(draw.sampler_idx)]), fragUv);
+    outColor = color;
 }
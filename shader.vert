@@ -1,21 +1,39 @@
 #version 460
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
-layout(location = 0) out vec3 fragColor;
+struct Instance {
+    mat4 transform;
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances {
+    Instance items[];
+} instances[];
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(push_constant) uniform DrawPush {
+    uint texture_idx;
+    uint sampler_idx;
+    uint buffer_idx;
+    layout(offset = 16) mat4 view_proj;
+} draw;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inUv;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUv;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    mat4 transform = mat4(1.0);
+    vec4 tint = vec4(1.0);
+    if(draw.buffer_idx != 0xFFFFFFFFu) {
+        Instance inst = instances[draw.buffer_idx].items[gl_InstanceIndex];
+        transform = inst.transform;
+        tint = inst.color;
+    }
+    gl_Position = draw.view_proj * transform * vec4(inPosition, 1.0);
+    fragColor = inColor * tint.rgb;
+    fragUv = inUv;
 }
@@ -1,8 +1,26 @@
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <ostream>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
 
+#include "shaders.hpp"
 #include "vg.hpp"
 
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
 namespace vg {
 
 static std::vector<char> readFile(const std::string& file_name) {
@@ -17,20 +35,462 @@ static std::vector<char> readFile(const std::string& file_name) {
   return buf;
 }
 
-Window::Window(const std::string& title, int width, int height) {
+struct GpuObject {
+  Instance instance;
+  std::array<float, 4> bounds;
+  std::uint32_t index_count;
+  std::uint32_t first_index;
+  std::int32_t vertex_offset;
+  std::uint32_t pad;
+};
+
+struct CullPush {
+  std::array<std::array<float, 4>, 6> planes;
+  std::uint32_t object_count;
+  std::uint32_t objects;
+  std::uint32_t visible;
+  std::uint32_t commands;
+  std::uint32_t count;
+};
+
+constexpr std::uint32_t view_proj_offset {16};
+
+struct PipelineCacheHeader {
+  std::uint32_t magic;
+  std::uint32_t vendor_id;
+  std::uint32_t device_id;
+  std::uint32_t driver_version;
+  std::array<std::uint8_t, VK_UUID_SIZE> device_uuid;
+};
+
+static PipelineCacheHeader getPipelineCacheHeader(vk::PhysicalDevice dev) {
+  const auto props {dev.getProperties2<vk::PhysicalDeviceProperties2,
+      vk::PhysicalDeviceIDProperties>()};
+  const auto& base {props.get<vk::PhysicalDeviceProperties2>().properties};
+  return {
+      .magic {0x43504756},
+      .vendor_id {base.vendorID},
+      .device_id {base.deviceID},
+      .driver_version {base.driverVersion},
+      .device_uuid {props.get<vk::PhysicalDeviceIDProperties>().deviceUUID},
+  };
+}
+
+constexpr vk::PipelineStageFlags upload_dst_stages {
+    vk::PipelineStageFlagBits::eVertexInput |
+    vk::PipelineStageFlagBits::eVertexShader |
+    vk::PipelineStageFlagBits::eFragmentShader |
+    vk::PipelineStageFlagBits::eComputeShader};
+
+constexpr vk::AccessFlags upload_dst_access {
+    vk::AccessFlagBits::eVertexAttributeRead |
+    vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eShaderRead};
+
+constexpr vk::AccessFlags graph_write_access {
+    vk::AccessFlagBits::eShaderWrite |
+    vk::AccessFlagBits::eColorAttachmentWrite |
+    vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eHostWrite |
+    vk::AccessFlagBits::eMemoryWrite};
+
+static bool isGraphWrite(vk::AccessFlags access) {
+  return static_cast<bool>(access & graph_write_access);
+}
+
+constexpr const char* validation_layer {"VK_LAYER_KHRONOS_validation"};
+
+static void logToStderr(LogSeverity severity, std::string_view message) {
+  static constexpr std::array names {"verbose", "info", "warning", "error"};
+  std::cerr << "vg " << names[static_cast<size_t>(severity)] << ": "
+            << message << "\n";
+}
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL debugMessage(
+    VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+    VkDebugUtilsMessageTypeFlagsEXT,
+    const VkDebugUtilsMessengerCallbackDataEXT* data, void* user) {
+  auto level {LogSeverity::eVerbose};
+  if(severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+    level = LogSeverity::eError;
+  else if(severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+    level = LogSeverity::eWarning;
+  else if(severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT)
+    level = LogSeverity::eInfo;
+  (*static_cast<const Logger*>(user))(level, data->pMessage);
+  return VK_FALSE;
+}
+
+constexpr vk::ImageSubresourceRange color_range {
+    .aspectMask {vk::ImageAspectFlagBits::eColor},
+    .baseMipLevel {0},
+    .levelCount {1},
+    .baseArrayLayer {0},
+    .layerCount {1},
+};
+
+using run_clock = std::chrono::steady_clock;
+
+constexpr std::chrono::microseconds pacing_slack {1000};
+
+class RunMeter {
+public:
+  RunMeter() : wall_start {run_clock::now()}, cpu_start {std::clock()} {}
+
+  RunStats finish(size_t frames) const {
+    const auto cpu_ticks {std::clock() - cpu_start};
+    return {
+        .frames {frames},
+        .wall {run_clock::now() - wall_start},
+        .cpu {std::chrono::nanoseconds {static_cast<std::int64_t>(
+            cpu_ticks * (1e9 / CLOCKS_PER_SEC))}},
+    };
+  }
+
+private:
+  run_clock::time_point wall_start;
+  std::clock_t cpu_start;
+};
+
+static void sleepUntil(run_clock::time_point deadline) {
+  std::this_thread::sleep_until(deadline - pacing_slack);
+  while(run_clock::now() < deadline)
+    std::this_thread::yield();
+}
+
+using Features10 = vk::PhysicalDeviceFeatures;
+using Features11 = vk::PhysicalDeviceVulkan11Features;
+using Features12 = vk::PhysicalDeviceVulkan12Features;
+
+template <typename T>
+struct FeatureRequirement {
+  const char* name;
+  vk::Bool32 T::*member;
+};
+
+constexpr auto required_features10 {
+    std::to_array<FeatureRequirement<Features10>>({
+        {"drawIndirectFirstInstance", &Features10::drawIndirectFirstInstance},
+        {"multiDrawIndirect", &Features10::multiDrawIndirect},
+        {"shaderSampledImageArrayDynamicIndexing",
+            &Features10::shaderSampledImageArrayDynamicIndexing},
+        {"shaderStorageBufferArrayDynamicIndexing",
+            &Features10::shaderStorageBufferArrayDynamicIndexing},
+    })};
+
+constexpr std::array<FeatureRequirement<Features11>, 0> required_features11 {};
+
+constexpr auto required_features12 {
+    std::to_array<FeatureRequirement<Features12>>({
+        {"drawIndirectCount", &Features12::drawIndirectCount},
+        {"timelineSemaphore", &Features12::timelineSemaphore},
+        {"runtimeDescriptorArray", &Features12::runtimeDescriptorArray},
+        {"descriptorBindingPartiallyBound",
+            &Features12::descriptorBindingPartiallyBound},
+        {"descriptorBindingSampledImageUpdateAfterBind",
+            &Features12::descriptorBindingSampledImageUpdateAfterBind},
+        {"descriptorBindingStorageBufferUpdateAfterBind",
+            &Features12::descriptorBindingStorageBufferUpdateAfterBind},
+        {"descriptorBindingUpdateUnusedWhilePending",
+            &Features12::descriptorBindingUpdateUnusedWhilePending},
+        {"shaderSampledImageArrayNonUniformIndexing",
+            &Features12::shaderSampledImageArrayNonUniformIndexing},
+    })};
+
+template <typename T>
+static void checkFeatures(const T& supported,
+    std::span<const FeatureRequirement<T>> required, std::string& missing) {
+  for(const auto& req : required)
+    if(!(supported.*req.member)) {
+      if(!missing.empty())
+        missing += ", ";
+      missing += req.name;
+    }
+}
+
+template <typename T>
+static void enableFeatures(
+    T& enabled, std::span<const FeatureRequirement<T>> required) {
+  for(const auto& req : required)
+    enabled.*req.member = true;
+}
+
+static std::string missingFeatures(vk::PhysicalDevice dev) {
+  const auto supported {dev.getFeatures2<vk::PhysicalDeviceFeatures2,
+      Features11, Features12>()};
+  std::string missing;
+  checkFeatures<Features10>(
+      supported.get<vk::PhysicalDeviceFeatures2>().features,
+      required_features10, missing);
+  checkFeatures<Features11>(
+      supported.get<Features11>(), required_features11, missing);
+  checkFeatures<Features12>(
+      supported.get<Features12>(), required_features12, missing);
+  return missing;
+}
+
+static void loadVulkan() {
+  static const vk::DynamicLoader loader;
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(
+      loader.getProcAddress<PFN_vkGetInstanceProcAddr>(
+          "vkGetInstanceProcAddr"));
+}
+
+static std::string formatUuid(
+    const vk::ArrayWrapper1D<std::uint8_t, VK_UUID_SIZE>& uuid) {
+  static constexpr char digits[] {"0123456789abcdef"};
+  std::string ret;
+  for(size_t i {0}; i < uuid.size(); i++) {
+    if(i == 4 || i == 6 || i == 8 || i == 10)
+      ret += '-';
+    ret += digits[uuid[i] >> 4];
+    ret += digits[uuid[i] & 0xf];
+  }
+  return ret;
+}
+
+static std::string deviceShortcomings(vk::PhysicalDevice dev,
+    const vk::PhysicalDeviceProperties& props, bool needs_present) {
+  if(props.apiVersion < VK_API_VERSION_1_2)
+    return "Vulkan 1.2 not supported";
+
+  if(const auto missing {missingFeatures(dev)}; !missing.empty())
+    return "missing features " + missing;
+
+  if(needs_present) {
+    const auto exts {dev.enumerateDeviceExtensionProperties()};
+    if(std::ranges::none_of(exts, [](const auto& ext) {
+         return !std::strcmp(
+             ext.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+       }))
+      return "no swapchain support";
+  }
+  return {};
+}
+
+static std::int64_t scoreDevice(vk::PhysicalDevice dev,
+    const vk::PhysicalDeviceProperties& props, vk::DeviceSize vram,
+    std::span<const vk::QueueFamilyProperties> qfams) {
+  std::int64_t score {0};
+  switch(props.deviceType) {
+  case vk::PhysicalDeviceType::eDiscreteGpu: score += 100000; break;
+  case vk::PhysicalDeviceType::eIntegratedGpu: score += 50000; break;
+  case vk::PhysicalDeviceType::eVirtualGpu: score += 25000; break;
+  case vk::PhysicalDeviceType::eOther: score += 10000; break;
+  default: break;
+  }
+  score += static_cast<std::int64_t>(vram >> 26);
+
+  const auto exts {dev.enumerateDeviceExtensionProperties()};
+  if(std::ranges::any_of(exts, [](const auto& ext) {
+       return !std::strcmp(
+           ext.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+     }))
+    score += 1000;
+
+  const auto has_family {[&](vk::QueueFlags flags, vk::QueueFlags excluded) {
+    return std::ranges::any_of(qfams, [&](const auto& qfam) {
+      return (qfam.queueFlags & flags) == flags &&
+          !(qfam.queueFlags & excluded);
+    });
+  }};
+  if(has_family(vk::QueueFlagBits::eTransfer,
+         vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))
+    score += 500;
+  if(has_family(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics))
+    score += 250;
+  return score;
+}
+
+std::vector<DeviceInfo> rankDevices(vk::Instance inst, vk::SurfaceKHR surf) {
+  std::vector<DeviceInfo> ranked;
+  const auto devs {inst.enumeratePhysicalDevices()};
+  for(std::uint32_t idx {0}; idx < devs.size(); idx++) {
+    const auto dev {devs[idx]};
+    const auto chain {dev.getProperties2<vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceIDProperties>()};
+    const auto& props {chain.get<vk::PhysicalDeviceProperties2>().properties};
+    const auto mem_props {dev.getMemoryProperties()};
+    vk::DeviceSize vram {0};
+    for(std::uint32_t i {0}; i < mem_props.memoryHeapCount; i++)
+      if(mem_props.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+        vram = std::max(vram, mem_props.memoryHeaps[i].size);
+
+    DeviceInfo info {
+        .dev {dev},
+        .index {idx},
+        .name {props.deviceName.data()},
+        .uuid {formatUuid(
+            chain.get<vk::PhysicalDeviceIDProperties>().deviceUUID)},
+        .type {props.deviceType},
+        .vram {vram},
+        .unsuitable {
+            deviceShortcomings(dev, props, static_cast<bool>(surf))},
+    };
+
+    const auto qfams {dev.getQueueFamilyProperties()};
+    std::optional<std::uint32_t> qfam_idx;
+    for(std::uint32_t i {0}; i < qfams.size() && !qfam_idx; i++)
+      if(qfams[i].queueFlags & vk::QueueFlagBits::eGraphics &&
+          (!surf || dev.getSurfaceSupportKHR(i, surf)))
+        qfam_idx = i;
+    if(surf && info.unsuitable.empty() &&
+        (dev.getSurfaceFormatsKHR(surf).empty() ||
+            dev.getSurfacePresentModesKHR(surf).empty()))
+      info.unsuitable = "cannot present to the surface";
+    if(!qfam_idx && info.unsuitable.empty())
+      info.unsuitable = surf ? "no graphics queue that can present"
+                             : "no graphics queue";
+
+    info.qfam_idx = qfam_idx.value_or(0);
+    if(info.unsuitable.empty())
+      info.score = scoreDevice(dev, props, vram, qfams);
+    ranked.push_back(std::move(info));
+  }
+
+  std::ranges::stable_sort(ranked, [](const auto& a, const auto& b) {
+    if(a.unsuitable.empty() != b.unsuitable.empty())
+      return a.unsuitable.empty();
+    return a.score > b.score;
+  });
+  return ranked;
+}
+
+std::vector<DeviceInfo> listDevices() {
+  loadVulkan();
+  const vk::ApplicationInfo app_info {
+      .apiVersion {VK_API_VERSION_1_2},
+  };
+  const auto inst {vk::createInstance({.pApplicationInfo {&app_info}})};
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(inst);
+  auto ranked {rankDevices(inst)};
+  inst.destroy();
+  return ranked;
+}
+
+const DeviceInfo* matchDevice(
+    std::span<const DeviceInfo> devices, std::string_view selector) {
+  const auto normalize {[](std::string_view str, bool strip_dashes) {
+    std::string ret;
+    for(unsigned char c : str)
+      if(c != '-' || !strip_dashes)
+        ret += static_cast<char>(std::tolower(c));
+    return ret;
+  }};
+  if(selector.empty())
+    return nullptr;
+
+  if(std::ranges::all_of(selector, [](unsigned char c) {
+       return std::isdigit(c);
+     })) {
+    std::uint32_t idx {0};
+    const auto end {selector.data() + selector.size()};
+    const auto [ptr, ec] {std::from_chars(selector.data(), end, idx)};
+    if(ec != std::errc {} || ptr != end)
+      return nullptr;
+    for(const auto& info : devices)
+      if(info.index == idx)
+        return &info;
+    return nullptr;
+  }
+
+  const auto uuid {normalize(selector, true)};
+  for(const auto& info : devices)
+    if(normalize(info.uuid, true) == uuid)
+      return &info;
+
+  const auto name {normalize(selector, false)};
+  for(const auto& info : devices)
+    if(normalize(info.name, false) == name)
+      return &info;
+  for(const auto& info : devices)
+    if(normalize(info.name, false).find(name) != std::string::npos)
+      return &info;
+  return nullptr;
+}
+
+void Window::markDirty(GLFWwindow* window) {
+  static_cast<State*>(glfwGetWindowUserPointer(window))->dirty = true;
+}
+
+Window::Window(const std::string& title, int width, int height)
+    : state {std::make_shared<State>()} {
   if(!glfwInit())
     throw std::runtime_error("Failed to init glfw");
 
   glfwWindowHint(GLFW_RESIZABLE, true);
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
   m_window = glfwCreateWindow(width, height, title.data(), nullptr, nullptr);
+
+  glfwSetWindowUserPointer(m_window, state.get());
+  glfwSetWindowRefreshCallback(m_window, markDirty);
+  glfwSetFramebufferSizeCallback(
+      m_window, [](GLFWwindow* window, int, int) { markDirty(window); });
+  glfwSetKeyCallback(m_window,
+      [](GLFWwindow* window, int, int, int, int) { markDirty(window); });
+  glfwSetMouseButtonCallback(m_window,
+      [](GLFWwindow* window, int, int, int) { markDirty(window); });
+  glfwSetCursorPosCallback(m_window,
+      [](GLFWwindow* window, double, double) { markDirty(window); });
+  glfwSetScrollCallback(m_window,
+      [](GLFWwindow* window, double, double) { markDirty(window); });
 }
 
-void Window::run_continuous(std::function<void()> f) {
+RunStats Window::run_continuous(std::function<void()> f) {
+  const RunMeter meter;
+  size_t frames {0};
   while(!glfwWindowShouldClose(m_window)) {
     glfwPollEvents();
     f();
+    frames++;
+  }
+  return meter.finish(frames);
+}
+
+RunStats Window::run_on_demand(std::function<void()> f) {
+  const RunMeter meter;
+  size_t frames {0};
+  state->dirty = true;
+  while(!glfwWindowShouldClose(m_window)) {
+    if(state->dirty)
+      glfwPollEvents();
+    else
+      glfwWaitEvents();
+
+    if(state->dirty.exchange(false)) {
+      f();
+      frames++;
+    }
+  }
+  return meter.finish(frames);
+}
+
+RunStats Window::run_paced(double fps, std::function<void()> f) {
+  if(fps <= 0.0)
+    throw std::runtime_error {"target fps must be positive"};
+
+  const auto period {std::chrono::duration_cast<run_clock::duration>(
+      std::chrono::duration<double> {1.0 / fps})};
+  const RunMeter meter;
+  size_t frames {0};
+  auto deadline {run_clock::now()};
+  while(!glfwWindowShouldClose(m_window)) {
+    glfwPollEvents();
+    f();
+    frames++;
+
+    deadline += period;
+    const auto now {run_clock::now()};
+    if(now > deadline + period)
+      deadline = now;
+    else
+      sleepUntil(deadline);
   }
+  return meter.finish(frames);
+}
+
+void Window::requestRedraw() {
+  state->dirty = true;
+  glfwPostEmptyEvent();
 }
 
 void Window::destroy() {
@@ -38,146 +498,1441 @@ void Window::destroy() {
   glfwTerminate();
 }
 
-Renderer::Renderer(Window window) : window {window} {
+JobSystem::JobSystem(size_t thread_count) {
+  workers.resize(std::max<size_t>(thread_count, 1));
+  for(auto& worker : workers)
+    worker = std::make_unique<Worker>();
+  for(size_t i {0}; i < workers.size(); i++)
+    workers[i]->thread = std::thread {&JobSystem::workerLoop, this, i};
+}
+
+void JobSystem::destroy() {
+  {
+    std::lock_guard lock {mtx};
+    stopping = true;
+  }
+  work_cv.notify_all();
+  for(auto& worker : workers)
+    worker->thread.join();
+  workers.clear();
+}
+
+void JobSystem::run(std::span<Job> jobs) {
+  if(jobs.empty())
+    return;
+
+  {
+    std::lock_guard lock {mtx};
+    pending += jobs.size();
+    queued += jobs.size();
+  }
+  for(size_t i {0}; i < jobs.size(); i++) {
+    auto& worker {*workers[i % workers.size()]};
+    std::lock_guard lock {worker.mtx};
+    worker.queue.push_back(&jobs[i]);
+  }
+  work_cv.notify_all();
+
+  std::unique_lock lock {mtx};
+  done_cv.wait(lock, [&] { return !pending; });
+  if(error)
+    std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+JobSystem::Job* JobSystem::pop(size_t idx) {
+  for(size_t i {0}; i < workers.size(); i++) {
+    auto& worker {*workers[(idx + i) % workers.size()]};
+    std::lock_guard lock {worker.mtx};
+    if(worker.queue.empty())
+      continue;
+
+    Job* job;
+    if(!i) {
+      job = worker.queue.back();
+      worker.queue.pop_back();
+    } else {
+      job = worker.queue.front();
+      worker.queue.pop_front();
+    }
+    queued--;
+    return job;
+  }
+  return nullptr;
+}
+
+void JobSystem::workerLoop(size_t idx) {
+  for(;;) {
+    if(auto job {pop(idx)}) {
+      std::exception_ptr job_error;
+      try {
+        (*job)(idx);
+      } catch(...) {
+        job_error = std::current_exception();
+      }
+      std::lock_guard lock {mtx};
+      if(job_error && !error)
+        error = job_error;
+      if(!--pending)
+        done_cv.notify_all();
+      continue;
+    }
+
+    std::unique_lock lock {mtx};
+    work_cv.wait(lock, [&] { return stopping || queued.load(); });
+    if(stopping)
+      return;
+  }
+}
+
+GpuAllocator::GpuAllocator(vk::PhysicalDevice phy_dev, vk::Device dev,
+    vk::DeviceSize block_size)
+    : dev {dev}, mem_props {phy_dev.getMemoryProperties()},
+      granularity {phy_dev.getProperties().limits.bufferImageGranularity} {
+  pools.resize(mem_props.memoryTypeCount * 2);
+  dedicated.resize(mem_props.memoryTypeCount);
+  for(std::uint32_t i {0}; i < pools.size(); i++) {
+    const auto type_idx {i / 2};
+    const auto heap_size {
+        mem_props.memoryHeaps[mem_props.memoryTypes[type_idx].heapIndex].size};
+    pools[i].type_idx = type_idx;
+    pools[i].block_size = std::bit_floor(
+        std::clamp(heap_size / 8, min_size, std::max(block_size, min_size)));
+    pools[i].max_order =
+        static_cast<std::uint8_t>(std::countr_zero(pools[i].block_size) -
+                                  std::countr_zero(min_size));
+  }
+}
+
+void GpuAllocator::destroy() {
+  for(auto& pool : pools)
+    for(auto& block : pool.blocks)
+      if(block.memory)
+        dev.free(block.memory);
+  pools.clear();
+  dedicated.clear();
+}
+
+std::uint32_t GpuAllocator::findMemoryType(
+    std::uint32_t type_bits, vk::MemoryPropertyFlags props) const {
+  for(std::uint32_t i {0}; i < mem_props.memoryTypeCount; i++)
+    if(type_bits & (1 << i) &&
+        (mem_props.memoryTypes[i].propertyFlags & props) == props)
+      return i;
+  throw std::runtime_error {"no suitable memory type found"};
+}
+
+vk::DeviceMemory GpuAllocator::allocateMemory(
+    std::uint32_t type_idx, vk::DeviceSize size, std::uint8_t** mapped) {
+  auto memory {dev.allocateMemory({
+      .allocationSize {size},
+      .memoryTypeIndex {type_idx},
+  })};
+  *mapped = nullptr;
+  if(mem_props.memoryTypes[type_idx].propertyFlags &
+      vk::MemoryPropertyFlagBits::eHostVisible)
+    *mapped =
+        static_cast<std::uint8_t*>(dev.mapMemory(memory, 0, VK_WHOLE_SIZE));
+  return memory;
+}
+
+std::uint32_t GpuAllocator::addBlock(Pool& pool) {
+  std::uint32_t idx {0};
+  while(idx < pool.blocks.size() && pool.blocks[idx].memory)
+    idx++;
+  if(idx == pool.blocks.size())
+    pool.blocks.emplace_back();
+
+  auto& block {pool.blocks[idx]};
+  block.memory = allocateMemory(pool.type_idx, pool.block_size, &block.mapped);
+  block.free_lists.assign(pool.max_order + 1, {});
+  block.free_lists[pool.max_order].insert(0);
+  return idx;
+}
+
+std::optional<vk::DeviceSize> GpuAllocator::take(
+    Block& block, std::uint8_t order) {
+  auto k {order};
+  while(k < block.free_lists.size() && block.free_lists[k].empty())
+    k++;
+  if(k == block.free_lists.size())
+    return std::nullopt;
+
+  const auto offset {*block.free_lists[k].begin()};
+  block.free_lists[k].erase(block.free_lists[k].begin());
+  while(k > order) {
+    k--;
+    block.free_lists[k].insert(offset + (min_size << k));
+  }
+  return offset;
+}
+
+GpuAllocation GpuAllocator::allocate(const vk::MemoryRequirements& reqs,
+    vk::MemoryPropertyFlags props, bool linear) {
+  GpuAllocation alloc {
+      .size {reqs.size},
+      .type_idx {findMemoryType(reqs.memoryTypeBits, props)},
+  };
+  alloc.pool_idx = alloc.type_idx * 2 + (granularity > 1 && !linear);
+  auto& pool {pools[alloc.pool_idx]};
+  const auto buddy_size {
+      std::bit_ceil(std::max({reqs.size, reqs.alignment, min_size}))};
+
+  if(buddy_size > pool.block_size) {
+    alloc.pool_idx = UINT32_MAX;
+    alloc.memory = allocateMemory(alloc.type_idx, alloc.size, &alloc.mapped);
+    dedicated[alloc.type_idx].bytes += alloc.size;
+    dedicated[alloc.type_idx].count++;
+    return alloc;
+  }
+
+  alloc.order = static_cast<std::uint8_t>(
+      std::countr_zero(buddy_size) - std::countr_zero(min_size));
+  std::optional<vk::DeviceSize> offset;
+  for(alloc.block_idx = 0; alloc.block_idx < pool.blocks.size();
+      alloc.block_idx++)
+    if(pool.blocks[alloc.block_idx].memory &&
+        (offset = take(pool.blocks[alloc.block_idx], alloc.order)))
+      break;
+  if(!offset) {
+    alloc.block_idx = addBlock(pool);
+    offset = take(pool.blocks[alloc.block_idx], alloc.order);
+  }
+
+  const auto& block {pool.blocks[alloc.block_idx]};
+  alloc.memory = block.memory;
+  alloc.offset = *offset;
+  if(block.mapped)
+    alloc.mapped = block.mapped + alloc.offset;
+  pool.used += buddy_size;
+  pool.requested += alloc.size;
+  pool.allocation_count++;
+  return alloc;
+}
+
+void GpuAllocator::free(const GpuAllocation& alloc) {
+  if(!alloc.memory)
+    return;
+
+  if(alloc.pool_idx == UINT32_MAX) {
+    dev.free(alloc.memory);
+    dedicated[alloc.type_idx].bytes -= alloc.size;
+    dedicated[alloc.type_idx].count--;
+    return;
+  }
+
+  auto& pool {pools[alloc.pool_idx]};
+  auto& block {pool.blocks[alloc.block_idx]};
+  pool.used -= min_size << alloc.order;
+  pool.requested -= alloc.size;
+  pool.allocation_count--;
+
+  auto offset {alloc.offset};
+  auto order {alloc.order};
+  while(order < pool.max_order) {
+    const auto buddy {offset ^ (min_size << order)};
+    auto it {block.free_lists[order].find(buddy)};
+    if(it == block.free_lists[order].end())
+      break;
+    block.free_lists[order].erase(it);
+    offset = std::min(offset, buddy);
+    order++;
+  }
+  block.free_lists[order].insert(offset);
+
+  const auto live_blocks {std::count_if(pool.blocks.begin(),
+      pool.blocks.end(), [](const auto& b) { return !!b.memory; })};
+  if(order == pool.max_order && live_blocks > 1) {
+    dev.free(block.memory);
+    block = {};
+  }
+}
+
+std::pair<vk::Buffer, GpuAllocation> GpuAllocator::createBuffer(
+    const vk::BufferCreateInfo& info, vk::MemoryPropertyFlags props) {
+  auto buf {dev.createBuffer(info)};
+  auto alloc {allocate(dev.getBufferMemoryRequirements(buf), props, true)};
+  dev.bindBufferMemory(buf, alloc.memory, alloc.offset);
+  return {buf, alloc};
+}
+
+std::pair<vk::Image, GpuAllocation> GpuAllocator::createImage(
+    const vk::ImageCreateInfo& info, vk::MemoryPropertyFlags props) {
+  auto img {dev.createImage(info)};
+  auto alloc {allocate(dev.getImageMemoryRequirements(img), props,
+      info.tiling == vk::ImageTiling::eLinear)};
+  dev.bindImageMemory(img, alloc.memory, alloc.offset);
+  return {img, alloc};
+}
+
+void GpuAllocator::destroy(vk::Buffer buf, const GpuAllocation& alloc) {
+  dev.destroy(buf);
+  free(alloc);
+}
+
+void GpuAllocator::destroy(vk::Image img, const GpuAllocation& alloc) {
+  dev.destroy(img);
+  free(alloc);
+}
+
+std::vector<GpuHeapStats> GpuAllocator::getStats() const {
+  std::vector<GpuHeapStats> stats(mem_props.memoryHeapCount);
+  for(std::uint32_t i {0}; i < mem_props.memoryHeapCount; i++)
+    stats[i].heap_size = mem_props.memoryHeaps[i].size;
+
+  for(const auto& pool : pools) {
+    auto& heap {stats[mem_props.memoryTypes[pool.type_idx].heapIndex]};
+    heap.used_bytes += pool.used;
+    heap.requested_bytes += pool.requested;
+    heap.allocation_count += pool.allocation_count;
+    for(const auto& block : pool.blocks) {
+      if(!block.memory)
+        continue;
+      heap.block_bytes += pool.block_size;
+      heap.block_count++;
+      for(size_t k {block.free_lists.size()}; k-- > 0;)
+        if(!block.free_lists[k].empty()) {
+          heap.largest_free =
+              std::max(heap.largest_free, min_size << k);
+          break;
+        }
+    }
+  }
+
+  for(std::uint32_t i {0}; i < dedicated.size(); i++) {
+    auto& heap {stats[mem_props.memoryTypes[i].heapIndex]};
+    heap.block_bytes += dedicated[i].bytes;
+    heap.used_bytes += dedicated[i].bytes;
+    heap.requested_bytes += dedicated[i].bytes;
+    heap.block_count += dedicated[i].count;
+    heap.allocation_count += dedicated[i].count;
+  }
+  return stats;
+}
+
+void DeletionQueue::push(std::uint64_t value, Deleter deleter) {
+  const auto pos {std::upper_bound(entries.begin(), entries.end(), value,
+      [](std::uint64_t lhs, const auto& entry) {
+        return lhs < entry.first;
+      })};
+  entries.insert(pos, {value, std::move(deleter)});
+}
+
+void DeletionQueue::collect(std::uint64_t completed) {
+  while(!entries.empty() && entries.front().first <= completed) {
+    auto deleter {std::move(entries.front().second)};
+    entries.pop_front();
+    deleter();
+  }
+}
+
+void DeletionQueue::flush() {
+  collect(UINT64_MAX);
+}
+
+FrameTimer::FrameTimer(size_t capacity)
+    : samples(std::max<size_t>(capacity, 1)) {}
+
+void FrameTimer::push(const FrameTiming& timing) {
+  samples[count++ % samples.size()] = timing;
+}
+
+void FrameTimer::setGpuTime(
+    std::uint64_t frame, std::chrono::nanoseconds gpu) {
+  for(size_t i {0}; i < size(); i++) {
+    auto& sample {samples[(count - 1 - i) % samples.size()]};
+    if(sample.frame == frame) {
+      sample.gpu = gpu;
+      return;
+    }
+  }
+}
+
+std::chrono::nanoseconds FrameTimer::percentile(
+    double p, std::chrono::nanoseconds FrameTiming::*field) const {
+  std::vector<std::chrono::nanoseconds> values;
+  values.reserve(size());
+  for(size_t i {0}; i < size(); i++)
+    if(samples[i].*field > std::chrono::nanoseconds::zero())
+      values.push_back(samples[i].*field);
+  if(values.empty())
+    return std::chrono::nanoseconds::zero();
+
+  const auto nth {values.begin() +
+      static_cast<std::ptrdiff_t>(
+          std::clamp(p, 0.0, 1.0) * (values.size() - 1) + 0.5)};
+  std::nth_element(values.begin(), nth, values.end());
+  return *nth;
+}
+
+void FrameTimer::dumpCsv(std::ostream& os) const {
+  const auto us {[](std::chrono::nanoseconds ns) {
+    return std::chrono::duration<double, std::micro> {ns}.count();
+  }};
+
+  os << "frame,frame_time_us,upload_us,wait_us,acquire_us,record_us,"
+        "submit_us,present_us,cpu_us,gpu_us\n";
+  for(size_t i {count - size()}; i < count; i++) {
+    const auto& t {samples[i % samples.size()]};
+    os << t.frame << ',' << us(t.frame_time) << ',' << us(t.upload) << ','
+       << us(t.wait) << ',' << us(t.acquire) << ',' << us(t.record) << ','
+       << us(t.submit) << ',' << us(t.present) << ',' << us(t.cpu) << ','
+       << us(t.gpu) << '\n';
+  }
+}
+
+StagingRing::StagingRing(GpuAllocator& allocator, vk::DeviceSize size) {
+  std::tie(buf, alloc) = allocator.createBuffer(
+      {
+          .size {size},
+          .usage {vk::BufferUsageFlagBits::eTransferSrc},
+          .sharingMode {vk::SharingMode::eExclusive},
+      },
+      vk::MemoryPropertyFlagBits::eHostVisible |
+          vk::MemoryPropertyFlagBits::eHostCoherent);
+}
 
+void StagingRing::destroy(GpuAllocator& allocator) {
+  allocator.destroy(buf, alloc);
+}
+
+std::optional<vk::DeviceSize> StagingRing::allocate(
+    vk::DeviceSize size, vk::DeviceSize align) {
+  if(head == tail && used)
+    return std::nullopt;
+
+  auto offset {(head + align - 1) / align * align};
+  vk::DeviceSize bytes {offset + size - head};
+  if(head >= tail && offset + size > capacity()) {
+    if(size > tail)
+      return std::nullopt;
+    offset = 0;
+    bytes = capacity() - head + size;
+  } else if(head < tail && offset + size > tail)
+    return std::nullopt;
+
+  head = offset + size;
+  used += bytes;
+  open_bytes += bytes;
+  return offset;
+}
+
+void StagingRing::close(std::uint64_t batch) {
+  if(!open_bytes)
+    return;
+  regions.push_back({batch, head, open_bytes});
+  open_bytes = 0;
+}
+
+void StagingRing::retire(std::uint64_t completed) {
+  while(!regions.empty() && regions.front().batch <= completed) {
+    tail = regions.front().end;
+    used -= regions.front().bytes;
+    regions.pop_front();
+  }
+  if(!used)
+    head = tail = 0;
+}
+
+RenderGraph::RenderGraph(vk::Device dev, GpuAllocator& allocator,
+    DeletionQueue& deletions, bool dynamic)
+    : dev {dev}, allocator {&allocator}, deletions {&deletions},
+      dynamic {dynamic} {}
+
+void RenderGraph::destroy() {
+  invalidate(0);
+  retireTransients(0);
+  for(auto& [key, render_pass] : render_passes)
+    dev.destroy(render_pass);
+  render_passes.clear();
+  reset();
+}
+
+GraphResource RenderGraph::importImage(vk::Image image, vk::ImageView view,
+    const GraphImageDesc& desc, const GraphAccess& initial,
+    const GraphAccess& final) {
+  resources.push_back({
+      .image {image},
+      .view {view},
+      .desc {desc},
+      .state {
+          .write_stages {initial.stages},
+          .write_access {initial.access},
+          .layout {initial.layout},
+      },
+      .final {final},
+  });
+  return static_cast<GraphResource>(resources.size() - 1);
+}
+
+GraphResource RenderGraph::importBuffer(
+    vk::Buffer buf, const GraphAccess& initial, const GraphAccess& final) {
+  resources.push_back({
+      .buffer {buf},
+      .state {
+          .write_stages {initial.stages},
+          .write_access {initial.access},
+      },
+      .final {final},
+  });
+  return static_cast<GraphResource>(resources.size() - 1);
+}
+
+GraphResource RenderGraph::createImage(const GraphImageDesc& desc) {
+  resources.push_back({
+      .desc {desc},
+      .transient {static_cast<std::uint32_t>(transient_descs.size())},
+  });
+  transient_descs.push_back(desc);
+  return static_cast<GraphResource>(resources.size() - 1);
+}
+
+void RenderGraph::addPass(std::string name, std::vector<Use> uses,
+    Record record) {
+  passes.push_back({
+      .name {std::move(name)},
+      .uses {std::move(uses)},
+      .record {std::move(record)},
+  });
+}
+
+void RenderGraph::timePass(std::string_view name, vk::QueryPool pool,
+    std::uint32_t first_query) {
+  const auto pass {std::find_if(passes.rbegin(), passes.rend(),
+      [&](const Pass& candidate) { return candidate.name == name; })};
+  if(pass == passes.rend())
+    throw std::runtime_error {"unknown render graph pass"};
+  pass->timestamps = pool;
+  pass->first_query = first_query;
+}
+
+void RenderGraph::addRenderPass(std::string name,
+    std::vector<GraphAttachment> colors, std::optional<GraphAttachment> depth,
+    std::vector<Use> uses, vk::SubpassContents contents, Record record) {
+  for(const auto& color : colors) {
+    vk::AccessFlags access {vk::AccessFlagBits::eColorAttachmentWrite};
+    if(color.load_op == vk::AttachmentLoadOp::eLoad)
+      access |= vk::AccessFlagBits::eColorAttachmentRead;
+    uses.push_back({color.image,
+        {
+            .stages {vk::PipelineStageFlagBits::eColorAttachmentOutput},
+            .access {access},
+            .layout {vk::ImageLayout::eColorAttachmentOptimal},
+        }});
+  }
+  if(depth)
+    uses.push_back({depth->image,
+        {
+            .stages {vk::PipelineStageFlagBits::eEarlyFragmentTests |
+                     vk::PipelineStageFlagBits::eLateFragmentTests},
+            .access {vk::AccessFlagBits::eDepthStencilAttachmentRead |
+                     vk::AccessFlagBits::eDepthStencilAttachmentWrite},
+            .layout {vk::ImageLayout::eDepthStencilAttachmentOptimal},
+        }});
+
+  passes.push_back({
+      .name {std::move(name)},
+      .uses {std::move(uses)},
+      .colors {std::move(colors)},
+      .depth {depth},
+      .contents {contents},
+      .record {std::move(record)},
+      .graphics {true},
+  });
+}
+
+vk::RenderPass RenderGraph::getRenderPass(
+    std::span<const vk::Format> colors, vk::Format depth) {
+  RenderPassKey key {
+      .formats {colors.begin(), colors.end()},
+      .depth {depth != vk::Format::eUndefined},
+  };
+  if(key.depth)
+    key.formats.push_back(depth);
+  key.load_ops.assign(key.formats.size(), vk::AttachmentLoadOp::eClear);
+  key.store_ops.assign(key.formats.size(), vk::AttachmentStoreOp::eStore);
+
+  auto& render_pass {render_passes[key]};
+  if(!render_pass)
+    render_pass = createRenderPass(key);
+  return render_pass;
+}
+
+void RenderGraph::execute(vk::CommandBuffer cmd, std::uint64_t frame) {
+  cull();
+  allocateTransients(frame);
+
+  for(auto& slot : slots) {
+    slot.stages = {};
+    slot.write_stages = {};
+    slot.write_access = {};
+  }
+  for(const auto& pass : passes)
+    if(pass.live)
+      for(const auto& [idx, access] : pass.uses)
+        if(const auto& res {resources[idx]}; res.transient) {
+          auto& slot {slots[transients[*res.transient].slot]};
+          slot.stages |= access.stages;
+          if(isGraphWrite(access.access)) {
+            slot.write_stages |= access.stages;
+            slot.write_access |= access.access & graph_write_access;
+          }
+        }
+
+  for(auto& res : resources)
+    if(res.transient) {
+      const auto& transient {transients[*res.transient]};
+      res.image = transient.image;
+      res.view = transient.view;
+      if(transient.image) {
+        const auto& slot {slots[transient.slot]};
+        res.state = {
+            .write_stages {slot.write_stages},
+            .write_access {slot.write_access},
+            .read_stages {slot.stages},
+        };
+      }
+    }
+
+  for(size_t i {0}; i < passes.size(); i++) {
+    const auto& pass {passes[i]};
+    if(!pass.live)
+      continue;
+
+    transition(cmd, pass.uses);
+    if(pass.timestamps)
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+          pass.timestamps, pass.first_query);
+    if(pass.graphics) {
+      pass.record(cmd, beginRenderPass(cmd, i));
+      endRenderPass(cmd);
+    } else
+      pass.record(cmd, {});
+    if(pass.timestamps)
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+          pass.timestamps, pass.first_query + 1);
+  }
+
+  std::vector<Use> finals;
+  for(size_t i {0}; i < resources.size(); i++)
+    if(resources[i].final.stages)
+      finals.push_back({static_cast<GraphResource>(i), resources[i].final});
+  transition(cmd, finals);
+}
+
+void RenderGraph::reset() {
+  resources.clear();
+  passes.clear();
+  transient_descs.clear();
+}
+
+void RenderGraph::invalidate(std::uint64_t frame) {
+  for(auto& [key, framebuffer] : framebuffers)
+    deletions->push(frame, [dev {dev}, framebuffer] {
+      dev.destroy(framebuffer);
+    });
+  framebuffers.clear();
+}
+
+void RenderGraph::cull() {
+  std::vector<bool> needed(resources.size());
+  for(size_t i {0}; i < resources.size(); i++)
+    needed[i] = static_cast<bool>(resources[i].final.stages);
+
+  culled = 0;
+  for(auto pass {passes.rbegin()}; pass != passes.rend(); ++pass) {
+    pass->live = std::any_of(pass->uses.begin(), pass->uses.end(),
+        [&](const Use& use) {
+          return isGraphWrite(use.second.access) && needed[use.first];
+        });
+    if(!pass->live) {
+      culled++;
+      continue;
+    }
+    for(const auto& [idx, access] : pass->uses)
+      needed[idx] = true;
+  }
+}
+
+void RenderGraph::allocateTransients(std::uint64_t frame) {
+  std::vector<Transient> wanted(transient_descs.size());
+  for(size_t i {0}; i < wanted.size(); i++) {
+    wanted[i].desc = transient_descs[i];
+    wanted[i].first = SIZE_MAX;
+  }
+  for(size_t i {0}; i < passes.size(); i++)
+    if(passes[i].live)
+      for(const auto& [idx, access] : passes[i].uses)
+        if(const auto& res {resources[idx]}; res.transient) {
+          auto& transient {wanted[*res.transient]};
+          transient.first = std::min(transient.first, i);
+          transient.last = std::max(transient.last, i);
+        }
+
+  if(std::equal(wanted.begin(), wanted.end(), transients.begin(),
+         transients.end(), [](const Transient& a, const Transient& b) {
+           return a.desc == b.desc && a.first == b.first && a.last == b.last;
+         }))
+    return;
+
+  invalidate(frame);
+  retireTransients(frame);
+  transients = std::move(wanted);
+
+  std::vector<size_t> order(transients.size());
+  for(size_t i {0}; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return transients[a].first < transients[b].first;
+  });
+
+  std::vector<std::pair<size_t, vk::MemoryRequirements>> slot_reqs;
+  for(auto idx : order) {
+    auto& transient {transients[idx]};
+    if(transient.first == SIZE_MAX)
+      continue;
+
+    transient.image = dev.createImage({
+        .imageType {vk::ImageType::e2D},
+        .format {transient.desc.format},
+        .extent {transient.desc.extent.width, transient.desc.extent.height, 1},
+        .mipLevels {1},
+        .arrayLayers {1},
+        .samples {vk::SampleCountFlagBits::e1},
+        .tiling {vk::ImageTiling::eOptimal},
+        .usage {transient.desc.usage},
+        .sharingMode {vk::SharingMode::eExclusive},
+        .initialLayout {vk::ImageLayout::eUndefined},
+    });
+    const auto reqs {dev.getImageMemoryRequirements(transient.image)};
+
+    auto slot {std::find_if(slot_reqs.begin(), slot_reqs.end(),
+        [&](const auto& slot) {
+          return slot.first < transient.first &&
+              (slot.second.memoryTypeBits & reqs.memoryTypeBits);
+        })};
+    if(slot == slot_reqs.end()) {
+      slot_reqs.push_back({transient.last, reqs});
+      slot = slot_reqs.end() - 1;
+    } else {
+      slot->first = transient.last;
+      slot->second.size = std::max(slot->second.size, reqs.size);
+      slot->second.alignment =
+          std::max(slot->second.alignment, reqs.alignment);
+      slot->second.memoryTypeBits &= reqs.memoryTypeBits;
+    }
+    transient.slot = static_cast<std::uint32_t>(slot - slot_reqs.begin());
+  }
+
+  slots.resize(slot_reqs.size());
+  for(size_t i {0}; i < slots.size(); i++)
+    slots[i].alloc = allocator->allocate(slot_reqs[i].second,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, false);
+
+  for(auto& transient : transients) {
+    if(!transient.image)
+      continue;
+
+    const auto& alloc {slots[transient.slot].alloc};
+    dev.bindImageMemory(transient.image, alloc.memory, alloc.offset);
+    transient.view = dev.createImageView({
+        .image {transient.image},
+        .viewType {vk::ImageViewType::e2D},
+        .format {transient.desc.format},
+        .subresourceRange {
+            .aspectMask {transient.desc.aspect},
+            .levelCount {1},
+            .layerCount {1},
+        },
+    });
+  }
+}
+
+void RenderGraph::retireTransients(std::uint64_t frame) {
+  if(transients.empty() && slots.empty())
+    return;
+
+  deletions->push(frame, [dev {dev}, allocator {allocator},
+                             retired {std::move(transients)},
+                             retired_slots {std::move(slots)}] {
+    for(auto& transient : retired)
+      if(transient.image) {
+        dev.destroy(transient.view);
+        dev.destroy(transient.image);
+      }
+    for(auto& slot : retired_slots)
+      allocator->free(slot.alloc);
+  });
+  transients.clear();
+  slots.clear();
+}
+
+void RenderGraph::transition(
+    vk::CommandBuffer cmd, std::span<const Use> uses) {
+  vk::PipelineStageFlags src_stages, dst_stages;
+  vk::MemoryBarrier memory;
+  std::vector<vk::ImageMemoryBarrier> images;
+  bool needed {false};
+
+  for(const auto& [idx, access] : uses) {
+    auto& res {resources[idx]};
+    auto& state {res.state};
+    const bool relayout {res.image && state.layout != access.layout};
+
+    if(!isGraphWrite(access.access) && !relayout) {
+      if(!state.write_stages ||
+          ((access.stages & ~state.read_stages) == vk::PipelineStageFlags {} &&
+              (access.access & ~state.read_access) == vk::AccessFlags {})) {
+        state.read_stages |= access.stages;
+        state.read_access |= access.access;
+        continue;
+      }
+      src_stages |= state.write_stages;
+      memory.srcAccessMask |= state.write_access;
+      memory.dstAccessMask |= access.access;
+      state.read_stages |= access.stages;
+      state.read_access |= access.access;
+    } else {
+      src_stages |= state.write_stages | state.read_stages;
+      if(relayout)
+        images.push_back({
+            .srcAccessMask {state.write_access},
+            .dstAccessMask {access.access},
+            .oldLayout {state.layout},
+            .newLayout {access.layout},
+            .srcQueueFamilyIndex {VK_QUEUE_FAMILY_IGNORED},
+            .dstQueueFamilyIndex {VK_QUEUE_FAMILY_IGNORED},
+            .image {res.image},
+            .subresourceRange {
+                .aspectMask {res.desc.aspect},
+                .levelCount {1},
+                .layerCount {1},
+            },
+        });
+      else {
+        memory.srcAccessMask |= state.write_access;
+        memory.dstAccessMask |= access.access;
+      }
+
+      const bool write {isGraphWrite(access.access)};
+      state = {
+          .write_stages {access.stages},
+          .write_access {access.access & graph_write_access},
+          .read_stages {write ? vk::PipelineStageFlags {} : access.stages},
+          .read_access {write ? vk::AccessFlags {} : access.access},
+          .layout {res.image ? access.layout : state.layout},
+      };
+    }
+    dst_stages |= access.stages;
+    needed = true;
+  }
+
+  if(!needed)
+    return;
+  if(!src_stages)
+    src_stages = vk::PipelineStageFlagBits::eTopOfPipe;
+  if(!dst_stages)
+    dst_stages = vk::PipelineStageFlagBits::eBottomOfPipe;
+  if(memory.srcAccessMask || memory.dstAccessMask)
+    cmd.pipelineBarrier(src_stages, dst_stages, {}, memory, {}, images);
+  else
+    cmd.pipelineBarrier(src_stages, dst_stages, {}, {}, {}, images);
+}
+
+vk::RenderPass RenderGraph::createRenderPass(const RenderPassKey& key) {
+  std::vector<vk::AttachmentDescription> attachments;
+  std::vector<vk::AttachmentReference> color_refs;
+  vk::AttachmentReference depth_ref;
+
+  for(std::uint32_t i {0}; i < key.formats.size(); i++) {
+    const bool is_depth {key.depth && i + 1 == key.formats.size()};
+    const auto layout {is_depth
+            ? vk::ImageLayout::eDepthStencilAttachmentOptimal
+            : vk::ImageLayout::eColorAttachmentOptimal};
+    attachments.push_back({
+        .format {key.formats[i]},
+        .samples {vk::SampleCountFlagBits::e1},
+        .loadOp {key.load_ops[i]},
+        .storeOp {key.store_ops[i]},
+        .stencilLoadOp {vk::AttachmentLoadOp::eDontCare},
+        .stencilStoreOp {vk::AttachmentStoreOp::eDontCare},
+        .initialLayout {layout},
+        .finalLayout {layout},
+    });
+    if(is_depth)
+      depth_ref = {.attachment {i}, .layout {layout}};
+    else
+      color_refs.push_back({.attachment {i}, .layout {layout}});
+  }
+
+  const vk::SubpassDescription subpass {
+      .colorAttachmentCount {static_cast<std::uint32_t>(color_refs.size())},
+      .pColorAttachments {color_refs.data()},
+      .pDepthStencilAttachment {key.depth ? &depth_ref : nullptr},
+  };
+  return dev.createRenderPass({
+      .attachmentCount {static_cast<std::uint32_t>(attachments.size())},
+      .pAttachments {attachments.data()},
+      .subpassCount {1},
+      .pSubpasses {&subpass},
+  });
+}
+
+vk::AttachmentStoreOp RenderGraph::storeOp(
+    GraphResource image, size_t pass_idx) const {
+  const auto& res {resources[image]};
+  if(res.transient && transients[*res.transient].last == pass_idx)
+    return vk::AttachmentStoreOp::eDontCare;
+  return vk::AttachmentStoreOp::eStore;
+}
+
+RenderTarget RenderGraph::beginRenderPass(
+    vk::CommandBuffer cmd, size_t pass_idx) {
+  if(dynamic)
+    return beginRendering(cmd, pass_idx);
+
+  const auto& pass {passes[pass_idx]};
+  RenderPassKey key {.depth {pass.depth.has_value()}};
+  RenderTarget target;
+  std::vector<vk::ImageView> views;
+  std::vector<vk::ClearValue> clears;
+
+  const auto add {[&](const GraphAttachment& attachment) {
+    const auto& res {resources[attachment.image]};
+    key.formats.push_back(res.desc.format);
+    key.load_ops.push_back(attachment.load_op);
+    key.store_ops.push_back(storeOp(attachment.image, pass_idx));
+    views.push_back(res.view);
+    clears.push_back(attachment.clear);
+    target.extent = res.desc.extent;
+  }};
+  for(const auto& color : pass.colors) {
+    add(color);
+    target.color_formats.push_back(resources[color.image].desc.format);
+  }
+  if(pass.depth) {
+    add(*pass.depth);
+    target.depth_format = resources[pass.depth->image].desc.format;
+  }
+
+  auto& render_pass {render_passes[key]};
+  if(!render_pass)
+    render_pass = createRenderPass(key);
+
+  auto& framebuffer {framebuffers[{render_pass, views}]};
+  if(!framebuffer)
+    framebuffer = dev.createFramebuffer({
+        .renderPass {render_pass},
+        .attachmentCount {static_cast<std::uint32_t>(views.size())},
+        .pAttachments {views.data()},
+        .width {target.extent.width},
+        .height {target.extent.height},
+        .layers {1},
+    });
+
+  cmd.beginRenderPass(
+      {
+          .renderPass {render_pass},
+          .framebuffer {framebuffer},
+          .renderArea {.extent {target.extent}},
+          .clearValueCount {static_cast<std::uint32_t>(clears.size())},
+          .pClearValues {clears.data()},
+      },
+      pass.contents);
+  target.render_pass = render_pass;
+  target.framebuffer = framebuffer;
+  return target;
+}
+
+RenderTarget RenderGraph::beginRendering(
+    vk::CommandBuffer cmd, size_t pass_idx) {
+  const auto& pass {passes[pass_idx]};
+  RenderTarget target;
+  std::vector<vk::RenderingAttachmentInfoKHR> colors;
+  vk::RenderingAttachmentInfoKHR depth;
+
+  const auto attach {
+      [&](const GraphAttachment& attachment, vk::ImageLayout layout) {
+        const auto& res {resources[attachment.image]};
+        target.extent = res.desc.extent;
+        return vk::RenderingAttachmentInfoKHR {
+            .imageView {res.view},
+            .imageLayout {layout},
+            .loadOp {attachment.load_op},
+            .storeOp {storeOp(attachment.image, pass_idx)},
+            .clearValue {attachment.clear},
+        };
+      }};
+  for(const auto& color : pass.colors) {
+    colors.push_back(
+        attach(color, vk::ImageLayout::eColorAttachmentOptimal));
+    target.color_formats.push_back(resources[color.image].desc.format);
+  }
+  if(pass.depth) {
+    depth = attach(
+        *pass.depth, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    target.depth_format = resources[pass.depth->image].desc.format;
+  }
+
+  vk::RenderingFlagsKHR flags;
+  if(pass.contents == vk::SubpassContents::eSecondaryCommandBuffers)
+    flags = vk::RenderingFlagBitsKHR::eContentsSecondaryCommandBuffers;
+  cmd.beginRenderingKHR({
+      .flags {flags},
+      .renderArea {.extent {target.extent}},
+      .layerCount {1},
+      .colorAttachmentCount {static_cast<std::uint32_t>(colors.size())},
+      .pColorAttachments {colors.data()},
+      .pDepthAttachment {pass.depth ? &depth : nullptr},
+  });
+  return target;
+}
+
+void RenderGraph::endRenderPass(vk::CommandBuffer cmd) {
+  if(dynamic)
+    cmd.endRenderingKHR();
+  else
+    cmd.endRenderPass();
+}
+
+Renderer::Renderer(Window window, RendererOptions opts)
+    : window {window}, opts {opts},
+      frames_in_flight {std::max<size_t>(opts.max_frames_in_flight, 1)},
+      frame_timer {opts.timing_history} {
+  init();
+}
+
+Renderer::Renderer(vk::Extent2D extent, RendererOptions opts)
+    : opts {opts},
+      frames_in_flight {std::max<size_t>(opts.max_frames_in_flight, 1)},
+      extent {extent}, frame_timer {opts.timing_history} {
+  init();
+}
+
+void Renderer::init() {
   createInstance();
-  createSurface();
+  if(!headless())
+    createSurface();
   chooseRenderGroup();
+  chooseTransferFamily();
   createDevice();
+  allocator = GpuAllocator {rend_group.dev, dev};
   gfx_q = dev.getQueue(rend_group.qfam_idx, 0);
+  xfer_q = dev.getQueue(rend_group.xfer_qfam_idx, 0);
+  createPipelineCache();
+  createGeometryBuffers();
+  createUploadResources();
+  createSyncPrimitives();
+  createBindless();
 
   chooseSurfaceFormat();
   chooseImageCount();
   chooseSwapExtent();
+  chooseDepthFormat();
 
-  cmd_pool = dev.createCommandPool({.queueFamilyIndex {rend_group.qfam_idx}});
+  createFrameResources();
+  createTimestampPool();
+  createRecordWorkers();
+  graph = RenderGraph {
+      dev, allocator, deletions, dynamic_rendering};
+  createPipeline();
+  createCullResources();
   createSwapchainDependents();
-
-  createSyncPrimitives();
 }
 
-void Renderer::createSwapchainDependents() {
-  createSwapchain();
-  images = dev.getSwapchainImagesKHR(swapchain);
+void Renderer::createSwapchainDependents(vk::SwapchainKHR old_swapchain) {
+  if(headless())
+    createOffscreenImages();
+  else {
+    createSwapchain(old_swapchain);
+    images = dev.getSwapchainImagesKHR(swapchain);
+  }
+  image_values.assign(images.size(), 0);
+  if(!headless()) {
+    render_finished.resize(images.size());
+    for(auto& sem : render_finished)
+      sem = dev.createSemaphore({});
+  }
 
   createImageViews();
-  createRenderPass();
-  createPipeline();
-  createFramebuffers();
-  cmd_bufs = dev.allocateCommandBuffers({
-      .commandPool {cmd_pool},
-      .commandBufferCount {static_cast<std::uint32_t>(framebuffers.size())},
-  });
-  recordCommandBuffers();
 }
 
 void Renderer::destroySwapchainDependents() {
-  for(auto fb : framebuffers)
-    dev.destroy(fb);
-  dev.destroy(pipeline);
-  dev.destroy(layout);
-  dev.destroy(render_pass);
-  for(auto image_view : image_views)
-    dev.destroy(image_view);
-
-  dev.destroy(swapchain);
+  graph.invalidate(frame_count);
+  deletions.push(frame_count, [dev {dev}, views {std::move(image_views)},
+                                  sems {std::move(render_finished)}] {
+    for(auto image_view : views)
+      dev.destroy(image_view);
+    for(auto sem : sems)
+      dev.destroy(sem);
+  });
+  image_views.clear();
+  render_finished.clear();
+
+  if(headless())
+    destroyOffscreenImages();
+  else
+    deletions.push(frame_count, [dev {dev}, old {swapchain}] {
+      dev.destroy(old);
+    });
 }
 
 void Renderer::destroy() {
   dev.waitIdle();
 
-  for(size_t i {0}; i < img_count; i++) {
-    dev.destroy(frame_inflight[i]);
+  dev.destroy(frame_timeline);
+  dev.destroy(timestamp_pool);
+  for(size_t i {0}; i < frames_in_flight; i++) {
     dev.destroy(image_available[i]);
-    dev.destroy(render_finished[i]);
+    dev.destroy(frame_pools[i]);
   }
-
-  dev.destroy(cmd_pool);
+  destroyRecordWorkers();
 
   destroySwapchainDependents();
+  destroyCullResources();
+  dev.destroy(pipeline);
+  dev.destroy(layout);
+  graph.destroy();
+  deletions.flush();
+  destroyBindless();
+  destroyUploadResources();
+  destroyGeometryBuffers();
+  allocator.destroy();
+
+  savePipelineCache();
+  dev.destroy(pipeline_cache);
 
   dev.destroy();
-  inst.destroy(surf);
+  if(!headless())
+    inst.destroy(surf);
+  if(messenger)
+    inst.destroyDebugUtilsMessengerEXT(messenger);
   inst.destroy();
 }
 
-void Renderer::draw() {
-  if(dev.waitForFences(std::array {frame_inflight[frame_idx]}, true,
-         UINT64_MAX) != vk::Result::eSuccess)
-    throw std::runtime_error {"wait failure or timeout"};
+Mesh Renderer::createMesh(std::span<const Vertex> vertices,
+    std::span<const std::uint32_t> indices) {
+  if(vertex_used + vertices.size_bytes() > opts.vertex_buffer_size ||
+      index_used + indices.size_bytes() > opts.index_buffer_size)
+    throw std::runtime_error {"geometry buffers exhausted"};
+
+  const Mesh mesh {
+      .index_count {static_cast<std::uint32_t>(indices.size())},
+      .first_index {static_cast<std::uint32_t>(
+          index_used / sizeof(std::uint32_t))},
+      .vertex_offset {static_cast<std::int32_t>(vertex_used / sizeof(Vertex))},
+  };
+  uploadBuffer(vertex_buf, vertex_used, std::as_bytes(vertices));
+  uploadBuffer(index_buf, index_used, std::as_bytes(indices));
+  vertex_used += vertices.size_bytes();
+  index_used += indices.size_bytes();
+  return mesh;
+}
+
+InstanceRange Renderer::createInstances(
+    std::span<const Instance> instances) {
+  if(instance_used + instances.size_bytes() > opts.instance_buffer_size)
+    throw std::runtime_error {"instance buffer exhausted"};
+
+  const InstanceRange range {
+      .first {static_cast<std::uint32_t>(instance_used / sizeof(Instance))},
+      .count {static_cast<std::uint32_t>(instances.size())},
+  };
+  uploadBuffer(instance_buf, instance_used, std::as_bytes(instances));
+  instance_used += instances.size_bytes();
+  return range;
+}
+
+void Renderer::submit(const DrawCommand& draw_cmd) {
+  draw_list.push_back(draw_cmd);
+}
 
-  auto [result, img_idx] {dev.acquireNextImageKHR(
-      swapchain, UINT64_MAX, image_available[frame_idx])};
+void Renderer::submitInstanced(
+    const Mesh& mesh, InstanceRange instances, DrawPush resources) {
+  resources.buffer = instance_idx;
+  draw_list.push_back({
+      .mesh {mesh},
+      .instance_count {instances.count},
+      .first_instance {instances.first},
+      .resources {resources},
+  });
+}
 
-  if(result == vk::Result::eSuboptimalKHR ||
-      result == vk::Result::eErrorOutOfDateKHR) {
+void Renderer::setPresentPolicy(PresentPolicy policy) {
+  opts.present_policy = policy;
+  if(!headless())
     recreateSwapchain();
-    return;
-  } else if(result != vk::Result::eSuccess)
-    throw std::runtime_error {"failed to acquire swapchain image"};
+}
 
-  if(image_inflight[img_idx] &&
-      dev.waitForFences(std::array {image_inflight[img_idx]}, true,
-          UINT64_MAX) != vk::Result::eSuccess)
-    throw std::runtime_error {"wait failure or timeout"};
-  image_inflight[img_idx] = frame_inflight[frame_idx];
+std::vector<DispatchCost> Renderer::measureDispatch(size_t calls) {
+  const auto& dispatcher {VULKAN_HPP_DEFAULT_DISPATCHER};
+  const auto pool {dev.createCommandPool({
+      .flags {vk::CommandPoolCreateFlagBits::eTransient},
+      .queueFamilyIndex {rend_group.qfam_idx},
+  })};
+  const VkCommandBuffer cmd {dev.allocateCommandBuffers({
+      .commandPool {pool},
+      .commandBufferCount {1},
+  })[0]};
+  const auto restart {[&] {
+    dev.resetCommandPool(pool);
+    vk::CommandBuffer {cmd}.begin(
+        {.flags {vk::CommandBufferUsageFlagBits::eOneTimeSubmit}});
+  }};
 
-  vk::PipelineStageFlags flags {
-      vk::PipelineStageFlagBits::eColorAttachmentOutput};
+  // Recorded commands are dropped every batch so command buffer growth
+  // stays out of the timed loops.
+  constexpr size_t batch {4096};
+  const auto time {[&](auto&& call) {
+    restart();
+    for(size_t i {0}; i < std::min(calls, batch); i++)
+      call();
+
+    std::chrono::duration<double, std::nano> elapsed {0};
+    for(size_t done {0}; done < calls;) {
+      const auto count {std::min(calls - done, batch)};
+      restart();
+      const auto start {run_clock::now()};
+      for(size_t i {0}; i < count; i++)
+        call();
+      elapsed += run_clock::now() - start;
+      done += count;
+    }
+    return elapsed.count() / std::max<size_t>(calls, 1);
+  }};
+  const auto measure {[&](const char* name, auto proto, auto&& invoke) {
+    using Fn = decltype(proto);
+    const auto trampoline {reinterpret_cast<Fn>(
+        dispatcher.vkGetInstanceProcAddr(inst, name))};
+    const auto direct {
+        reinterpret_cast<Fn>(dispatcher.vkGetDeviceProcAddr(dev, name))};
+    return DispatchCost {
+        .call {name},
+        .trampoline_ns {time([&] { invoke(trampoline); })},
+        .direct_ns {time([&] { invoke(direct); })},
+    };
+  }};
+
+  const VkRect2D scissor {{0, 0}, {extent.width, extent.height}};
+  const VkDevice raw_dev {dev};
+  const VkSemaphore timeline {frame_timeline};
+  std::uint64_t value {0};
+  std::vector<DispatchCost> costs {
+      measure("vkCmdSetScissor", PFN_vkCmdSetScissor {},
+          [&](PFN_vkCmdSetScissor fn) { fn(cmd, 0, 1, &scissor); }),
+      measure("vkGetSemaphoreCounterValue", PFN_vkGetSemaphoreCounterValue {},
+          [&](PFN_vkGetSemaphoreCounterValue fn) {
+            fn(raw_dev, timeline, &value);
+          }),
+  };
+
+  vk::CommandBuffer {cmd}.end();
+  dev.destroy(pool);
+  return costs;
+}
+
+void Renderer::setRecordThreads(size_t thread_count) {
+  destroyRecordWorkers();
+  opts.record_threads = thread_count;
+  createRecordWorkers();
+}
+
+void Renderer::draw() {
+  using clock = std::chrono::steady_clock;
+  const auto start {clock::now()};
+  auto mark {start};
+  const auto lap {[&] {
+    const auto now {clock::now()};
+    const std::chrono::nanoseconds elapsed {now - mark};
+    mark = now;
+    return elapsed;
+  }};
+
+  FrameTiming timing {.frame {frame_count + 1}};
+  if(last_draw_start != clock::time_point {})
+    timing.frame_time = start - last_draw_start;
+  last_draw_start = start;
+
+  retireUploads(false);
+  flushUploads();
+  deletions.collect(getCompletedFrame());
+  timing.upload = lap();
+
+  waitFrame(frame_values[frame_idx]);
+  readTimestamps(frame_idx);
+  timing.wait = lap();
+
+  std::uint32_t img_idx {static_cast<std::uint32_t>(frame_idx)};
+  if(!headless()) {
+    try {
+      img_idx = dev.acquireNextImageKHR(
+                       swapchain, UINT64_MAX, image_available[frame_idx])
+                    .value;
+    } catch(vk::OutOfDateKHRError&) {
+      draw_list.clear();
+      object_draw.reset();
+      recreateSwapchain();
+      window->requestRedraw();
+      return;
+    }
+  }
+  timing.acquire = lap();
+
+  waitFrame(image_values[img_idx]);
+  timing.wait += lap();
+  const auto frame_value {frame_count + 1};
+
+  dev.resetCommandPool(frame_pools[frame_idx]);
+  recordCommandBuffer(frame_cmds[frame_idx], img_idx);
+  draw_list.clear();
+  object_draw.reset();
+  pending_acquires.clear();
+  pending_image_acquires.clear();
+  timing.record = lap();
+
+  const std::array wait_sems {image_available[frame_idx], upload_timeline};
+  const std::array<vk::PipelineStageFlags, 2> wait_stages {
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      upload_dst_stages,
+  };
+  const std::array<std::uint64_t, 2> wait_values {0, upload_wait_value};
+  const std::array signal_sems {frame_timeline,
+      headless() ? vk::Semaphore {} : render_finished[img_idx]};
+  const std::array<std::uint64_t, 2> signal_values {frame_value, 0};
+  const std::uint32_t skip {headless() ? 1u : 0u};
+  const vk::TimelineSemaphoreSubmitInfo timeline_info {
+      .waitSemaphoreValueCount {2 - skip},
+      .pWaitSemaphoreValues {wait_values.data() + skip},
+      .signalSemaphoreValueCount {2 - skip},
+      .pSignalSemaphoreValues {signal_values.data()},
+  };
   std::array submit_info {vk::SubmitInfo {
-      .waitSemaphoreCount {1},
-      .pWaitSemaphores {&image_available[frame_idx]},
-      .pWaitDstStageMask {&flags},
+      .pNext {&timeline_info},
+      .waitSemaphoreCount {2 - skip},
+      .pWaitSemaphores {wait_sems.data() + skip},
+      .pWaitDstStageMask {wait_stages.data() + skip},
       .commandBufferCount {1},
-      .pCommandBuffers {&cmd_bufs[img_idx]},
-      .signalSemaphoreCount {1},
-      .pSignalSemaphores {&render_finished[frame_idx]},
+      .pCommandBuffers {&frame_cmds[frame_idx]},
+      .signalSemaphoreCount {2 - skip},
+      .pSignalSemaphores {signal_sems.data()},
   }};
 
-  dev.resetFences(std::array {frame_inflight[frame_idx]});
-  gfx_q.submit(submit_info, frame_inflight[frame_idx]);
+  gfx_q.submit(submit_info);
+  frame_count = frame_value;
+  frame_values[frame_idx] = frame_value;
+  image_values[img_idx] = frame_value;
+  timing.submit = lap();
 
-  try {
-    result = gfx_q.presentKHR({
-        .waitSemaphoreCount {1},
-        .pWaitSemaphores {&render_finished[frame_idx]},
-        .swapchainCount {1},
-        .pSwapchains {&swapchain},
-        .pImageIndices {&img_idx},
-    });
-  } catch(vk::SystemError& err) {
-    if(err.code() == vk::Result::eSuboptimalKHR ||
-        err.code() == vk::Result::eErrorOutOfDateKHR)
+  if(headless())
+    last_img = img_idx;
+  else {
+    bool stale {false};
+    try {
+      stale = gfx_q.presentKHR({
+                  .waitSemaphoreCount {1},
+                  .pWaitSemaphores {&render_finished[img_idx]},
+                  .swapchainCount {1},
+                  .pSwapchains {&swapchain},
+                  .pImageIndices {&img_idx},
+              }) == vk::Result::eSuboptimalKHR;
+    } catch(vk::OutOfDateKHRError&) {
+      stale = true;
+    }
+    if(stale) {
       recreateSwapchain();
-    else
-      throw err;
+      window->requestRedraw();
+    }
+    timing.present = lap();
   }
 
-  ++frame_idx %= img_count;
+  timing.cpu = clock::now() - start;
+  frame_timer.push(timing);
+  ++frame_idx %= frames_in_flight;
+}
+
+std::uint64_t Renderer::getCompletedFrame() const {
+  return dev.getSemaphoreCounterValue(frame_timeline);
+}
+
+void Renderer::waitFrame(std::uint64_t value) const {
+  if(dev.waitSemaphores(
+         {
+             .semaphoreCount {1},
+             .pSemaphores {&frame_timeline},
+             .pValues {&value},
+         },
+         UINT64_MAX) != vk::Result::eSuccess)
+    throw std::runtime_error {"wait failure or timeout"};
+}
+
+std::vector<std::uint8_t> Renderer::readPixels() {
+  if(!last_img)
+    throw std::runtime_error {"no headless frame has been drawn"};
+
+  waitFrame(image_values[*last_img]);
+
+  const auto ptr {readback_allocs[*last_img].mapped};
+  const size_t size {extent.width * extent.height * 4};
+  return std::vector<std::uint8_t>(ptr, ptr + size);
 }
 
 void Renderer::createInstance() {
-  const char* validation_layer {"VK_LAYER_KHRONOS_validation"};
-  std::uint32_t glfw_count;
-  const char** glfw_exts {glfwGetRequiredInstanceExtensions(&glfw_count)};
-  std::vector<const char*> extensions(glfw_exts, glfw_exts + glfw_count);
-  extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+  loadVulkan();
+  if(!opts.logger)
+    opts.logger = logToStderr;
+
+  std::vector<const char*> layers;
+  std::vector<const char*> extensions;
+  if(!headless()) {
+    std::uint32_t glfw_count;
+    const char** glfw_exts {glfwGetRequiredInstanceExtensions(&glfw_count)};
+    extensions.assign(glfw_exts, glfw_exts + glfw_count);
+  }
 
+  if(opts.validation) {
+    const auto available {vk::enumerateInstanceLayerProperties()};
+    if(std::ranges::none_of(available, [](const auto& layer) {
+         return std::string_view {layer.layerName.data()} == validation_layer;
+       })) {
+      opts.logger(LogSeverity::eWarning,
+          "validation requested but VK_LAYER_KHRONOS_validation is not "
+          "installed; continuing without it");
+      opts.validation = false;
+    } else {
+      layers.push_back(validation_layer);
+      extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    }
+  }
+
+  const vk::DebugUtilsMessengerCreateInfoEXT messenger_info {
+      .messageSeverity {vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
+                        vk::DebugUtilsMessageSeverityFlagBitsEXT::eError},
+      .messageType {vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
+                    vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation |
+                    vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance},
+      .pfnUserCallback {debugMessage},
+      .pUserData {&opts.logger},
+  };
   const vk::ApplicationInfo app_info {
       .apiVersion {VK_API_VERSION_1_2},
   };
   inst = vk::createInstance({
+      .pNext {opts.validation ? &messenger_info : nullptr},
       .pApplicationInfo {&app_info},
-      .enabledLayerCount {1},
-      .ppEnabledLayerNames {&validation_layer},
+      .enabledLayerCount {static_cast<std::uint32_t>(layers.size())},
+      .ppEnabledLayerNames {layers.data()},
       .enabledExtensionCount {static_cast<std::uint32_t>(extensions.size())},
       .ppEnabledExtensionNames {extensions.data()},
   });
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(inst);
+
+  if(opts.validation)
+    messenger =
+        inst.createDebugUtilsMessengerEXT(messenger_info);
 }
 
 void Renderer::createSurface() {
   VkSurfaceKHR _surf;
-  if(glfwCreateWindowSurface(inst, window, nullptr, &_surf) != VK_SUCCESS)
+  if(glfwCreateWindowSurface(inst, *window, nullptr, &_surf) != VK_SUCCESS)
     throw std::runtime_error {"failed to create window surface"};
   surf = _surf;
 }
@@ -191,49 +1946,126 @@ SurfaceDetails Renderer::getSurfaceDetails(vk::PhysicalDevice phy_dev) {
 }
 
 void Renderer::chooseRenderGroup() {
-  std::vector<RenderGroup> valid_groups;
-  for(const auto dev : inst.enumeratePhysicalDevices()) {
+  const auto ranked {rankDevices(inst, headless() ? vk::SurfaceKHR {} : surf)};
+  std::string selector {opts.device};
+  if(selector.empty())
+    if(const char* env {std::getenv("VG_DEVICE")})
+      selector = env;
+
+  const DeviceInfo* chosen {nullptr};
+  if(!selector.empty()) {
+    chosen = matchDevice(ranked, selector);
+    if(!chosen)
+      throw std::runtime_error {"no device matches \"" + selector + "\""};
+    if(!chosen->unsuitable.empty())
+      throw std::runtime_error {
+          "device " + chosen->name + " is unsuitable: " + chosen->unsuitable};
+  } else if(!ranked.empty() && ranked[0].unsuitable.empty())
+    chosen = &ranked[0];
+  if(!chosen)
+    throw std::runtime_error {"no suitable device group found"};
 
-    auto surf_details {getSurfaceDetails(dev)};
-    if(surf_details.formats.empty() || surf_details.present_modes.empty())
-      continue;
+  rend_group = {
+      .dev {chosen->dev},
+      .qfam_idx {chosen->qfam_idx},
+  };
+  if(!headless())
+    rend_group.surf_details = getSurfaceDetails(chosen->dev);
+}
+
+void Renderer::chooseTransferFamily() {
+  const auto qfams {rend_group.dev.getQueueFamilyProperties()};
+  const auto pick {[&](vk::QueueFlags flags, vk::QueueFlags excluded) {
+    for(std::uint32_t i {0}; i < qfams.size(); i++)
+      if((qfams[i].queueFlags & flags) == flags &&
+          !(qfams[i].queueFlags & excluded))
+        return std::optional {i};
+    return std::optional<std::uint32_t> {};
+  }};
 
-    auto qfams {dev.getQueueFamilyProperties()};
-    for(std::uint32_t i {0}; i < qfams.size(); i++)
-      if(qfams[i].queueFlags & vk::QueueFlagBits::eGraphics &&
-          dev.getSurfaceSupportKHR(i, surf)) {
-        rend_group = {dev, i, surf_details};
-        if(dev.getProperties().deviceType ==
-            vk::PhysicalDeviceType::eDiscreteGpu)
-          return;
-        valid_groups.push_back(rend_group);
-      }
-  }
-  if(valid_groups.empty())
-    throw std::runtime_error {"no suitable device group found"};
-  rend_group = valid_groups[0];
+  auto idx {pick(vk::QueueFlagBits::eTransfer,
+      vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)};
+  if(!idx)
+    idx = pick(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics);
+  rend_group.xfer_qfam_idx = idx.value_or(rend_group.qfam_idx);
 }
 
 void Renderer::createDevice() {
   const float one {1.0f};
-  const auto feats {rend_group.dev.getFeatures()};
-  const vk::DeviceQueueCreateInfo q_info {
-      .queueFamilyIndex {rend_group.qfam_idx},
-      .queueCount {1},
-      .pQueuePriorities {&one},
+  if(const auto missing {missingFeatures(rend_group.dev)}; !missing.empty())
+    throw std::runtime_error {
+        std::string {rend_group.dev.getProperties().deviceName.data()} +
+        " lacks required features: " + missing};
+
+  dynamic_rendering = opts.dynamic_rendering && supportsDynamicRendering();
+  vk::StructureChain<vk::PhysicalDeviceFeatures2, Features11, Features12,
+      vk::PhysicalDeviceDynamicRenderingFeaturesKHR>
+      feats;
+  enableFeatures<Features10>(
+      feats.get<vk::PhysicalDeviceFeatures2>().features, required_features10);
+  enableFeatures<Features11>(feats.get<Features11>(), required_features11);
+  enableFeatures<Features12>(feats.get<Features12>(), required_features12);
+  feats.get<vk::PhysicalDeviceDynamicRenderingFeaturesKHR>().dynamicRendering =
+      true;
+  if(!dynamic_rendering)
+    feats.unlink<vk::PhysicalDeviceDynamicRenderingFeaturesKHR>();
+
+  const std::array q_infos {
+      vk::DeviceQueueCreateInfo {
+          .queueFamilyIndex {rend_group.qfam_idx},
+          .queueCount {1},
+          .pQueuePriorities {&one},
+      },
+      vk::DeviceQueueCreateInfo {
+          .queueFamilyIndex {rend_group.xfer_qfam_idx},
+          .queueCount {1},
+          .pQueuePriorities {&one},
+      },
   };
-  const char* swap_ext {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+  std::vector<const char*> exts;
+  if(!headless())
+    exts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  if(dynamic_rendering)
+    exts.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
 
   dev = rend_group.dev.createDevice({
-      .queueCreateInfoCount {1},
-      .pQueueCreateInfos {&q_info},
-      .enabledExtensionCount {1},
-      .ppEnabledExtensionNames {&swap_ext},
-      .pEnabledFeatures {&feats},
+      .pNext {&feats.get<vk::PhysicalDeviceFeatures2>()},
+      .queueCreateInfoCount {
+          rend_group.xfer_qfam_idx == rend_group.qfam_idx ? 1u : 2u},
+      .pQueueCreateInfos {q_infos.data()},
+      .enabledExtensionCount {static_cast<std::uint32_t>(exts.size())},
+      .ppEnabledExtensionNames {exts.data()},
   });
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(dev);
+}
+
+bool Renderer::supportsDynamicRendering() const {
+  const auto exts {rend_group.dev.enumerateDeviceExtensionProperties()};
+  const bool has_ext {std::any_of(exts.begin(), exts.end(), [](auto& ext) {
+    return !std::strcmp(
+        ext.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+  })};
+  return has_ext &&
+      rend_group.dev
+          .getFeatures2<vk::PhysicalDeviceFeatures2,
+              vk::PhysicalDeviceDynamicRenderingFeaturesKHR>()
+          .get<vk::PhysicalDeviceDynamicRenderingFeaturesKHR>()
+          .dynamicRendering;
 }
 
 void Renderer::chooseSurfaceFormat() {
+  if(headless()) {
+    const auto needed {vk::FormatFeatureFlagBits::eColorAttachment |
+        vk::FormatFeatureFlagBits::eTransferSrc};
+    for(auto fmt : {vk::Format::eR8G8B8A8Srgb, vk::Format::eB8G8R8A8Srgb})
+      if((rend_group.dev.getFormatProperties(fmt).optimalTilingFeatures &
+             needed) == needed) {
+        format = {fmt, vk::ColorSpaceKHR::eVkColorspaceSrgbNonlinear};
+        return;
+      }
+    throw std::runtime_error {"no suitable offscreen format found"};
+  }
+
   for(const auto& fmt : rend_group.surf_details.formats)
     if(fmt.format == vk::Format::eB8G8R8A8Srgb &&
         fmt.colorSpace == vk::ColorSpaceKHR::eVkColorspaceSrgbNonlinear) {
@@ -244,6 +2076,10 @@ void Renderer::chooseSurfaceFormat() {
 }
 
 void Renderer::chooseImageCount() {
+  if(headless()) {
+    img_count = static_cast<std::uint32_t>(frames_in_flight);
+    return;
+  }
   img_count = rend_group.surf_details.caps.minImageCount + 1;
   if(rend_group.surf_details.caps.maxImageCount &&
       img_count > rend_group.surf_details.caps.maxImageCount)
@@ -251,11 +2087,14 @@ void Renderer::chooseImageCount() {
 }
 
 void Renderer::chooseSwapExtent() {
+  if(headless())
+    return;
+
   if(rend_group.surf_details.caps.currentExtent.width != UINT32_MAX)
     extent = rend_group.surf_details.caps.currentExtent;
   else {
     int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
+    glfwGetFramebufferSize(*window, &width, &height);
     extent.width = {std::clamp(static_cast<std::uint32_t>(width),
         rend_group.surf_details.caps.minImageExtent.width,
         rend_group.surf_details.caps.maxImageExtent.width)};
@@ -265,18 +2104,43 @@ void Renderer::chooseSwapExtent() {
   }
 }
 
-vk::PresentModeKHR Renderer::choosePresentMode() {
-  vk::PresentModeKHR ret {vk::PresentModeKHR::eFifo};
-  for(auto present_mode : rend_group.surf_details.present_modes) {
-    if(present_mode == vk::PresentModeKHR::eMailbox)
-      return vk::PresentModeKHR::eMailbox;
-    else if(present_mode == vk::PresentModeKHR::eImmediate)
-      ret = present_mode;
+void Renderer::chooseDepthFormat() {
+  for(auto candidate : {vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint,
+          vk::Format::eD24UnormS8Uint}) {
+    const auto props {rend_group.dev.getFormatProperties(candidate)};
+    if(props.optimalTilingFeatures &
+        vk::FormatFeatureFlagBits::eDepthStencilAttachment) {
+      depth_format = candidate;
+      return;
+    }
   }
-  return ret;
+  throw std::runtime_error {"no supported depth format"};
+}
+
+void Renderer::choosePresentMode() {
+  static constexpr std::array low_latency {
+      vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate};
+  static constexpr std::array power_saving {vk::PresentModeKHR::eFifo};
+  static constexpr std::array max_throughput {vk::PresentModeKHR::eImmediate,
+      vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eFifoRelaxed};
+
+  std::span<const vk::PresentModeKHR> preferred {low_latency};
+  if(opts.present_policy == PresentPolicy::ePowerSaving)
+    preferred = power_saving;
+  else if(opts.present_policy == PresentPolicy::eMaxThroughput)
+    preferred = max_throughput;
+
+  const auto& available {rend_group.surf_details.present_modes};
+  present_mode = vk::PresentModeKHR::eFifo;
+  for(auto mode : preferred)
+    if(std::ranges::find(available, mode) != available.end()) {
+      present_mode = mode;
+      return;
+    }
 }
 
-void Renderer::createSwapchain() {
+void Renderer::createSwapchain(vk::SwapchainKHR old_swapchain) {
+  choosePresentMode();
   swapchain = dev.createSwapchainKHR({
       .surface {surf},
       .minImageCount {img_count},
@@ -288,26 +2152,553 @@ void Renderer::createSwapchain() {
       .imageSharingMode {vk::SharingMode::eExclusive},
       .preTransform {rend_group.surf_details.caps.currentTransform},
       .compositeAlpha {vk::CompositeAlphaFlagBitsKHR::eOpaque},
-      .presentMode {choosePresentMode()},
+      .presentMode {present_mode},
       .clipped {true},
+      .oldSwapchain {old_swapchain},
   });
 }
 
 void Renderer::recreateSwapchain() {
   int width, height;
-  glfwGetFramebufferSize(window, &width, &height);
+  glfwGetFramebufferSize(*window, &width, &height);
   while(!width || !height) {
     glfwWaitEvents();
-    glfwGetFramebufferSize(window, &width, &height);
+    glfwGetFramebufferSize(*window, &width, &height);
   }
 
-  dev.waitIdle();
-  dev.freeCommandBuffers(cmd_pool, cmd_bufs);
-  destroySwapchainDependents();
   rend_group.surf_details.caps =
       rend_group.dev.getSurfaceCapabilitiesKHR(surf);
   chooseSwapExtent();
-  createSwapchainDependents();
+
+  const auto old_swapchain {swapchain};
+  destroySwapchainDependents();
+  createSwapchainDependents(old_swapchain);
+}
+
+void Renderer::createOffscreenImages() {
+  const vk::DeviceSize size {extent.width * extent.height * 4};
+  images.resize(img_count);
+  image_allocs.resize(img_count);
+  readback_bufs.resize(img_count);
+  readback_allocs.resize(img_count);
+
+  for(size_t i {0}; i < img_count; i++) {
+    std::tie(images[i], image_allocs[i]) = allocator.createImage(
+        {
+            .imageType {vk::ImageType::e2D},
+            .format {format.format},
+            .extent {extent.width, extent.height, 1},
+            .mipLevels {1},
+            .arrayLayers {1},
+            .samples {vk::SampleCountFlagBits::e1},
+            .tiling {vk::ImageTiling::eOptimal},
+            .usage {vk::ImageUsageFlagBits::eColorAttachment |
+                    vk::ImageUsageFlagBits::eTransferSrc},
+            .sharingMode {vk::SharingMode::eExclusive},
+            .initialLayout {vk::ImageLayout::eUndefined},
+        },
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    std::tie(readback_bufs[i], readback_allocs[i]) = allocator.createBuffer(
+        {
+            .size {size},
+            .usage {vk::BufferUsageFlagBits::eTransferDst},
+            .sharingMode {vk::SharingMode::eExclusive},
+        },
+        vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
+  }
+}
+
+void Renderer::destroyOffscreenImages() {
+  deletions.push(frame_count,
+      [this, imgs {std::move(images)}, img_allocs {std::move(image_allocs)},
+          bufs {std::move(readback_bufs)},
+          buf_allocs {std::move(readback_allocs)}] {
+        for(size_t i {0}; i < imgs.size(); i++) {
+          allocator.destroy(imgs[i], img_allocs[i]);
+          allocator.destroy(bufs[i], buf_allocs[i]);
+        }
+      });
+  images.clear();
+  image_allocs.clear();
+  readback_bufs.clear();
+  readback_allocs.clear();
+  last_img.reset();
+}
+
+void Renderer::createGeometryBuffers() {
+  std::tie(vertex_buf, vertex_alloc) = allocator.createBuffer(
+      {
+          .size {opts.vertex_buffer_size},
+          .usage {vk::BufferUsageFlagBits::eVertexBuffer |
+                  vk::BufferUsageFlagBits::eTransferDst},
+          .sharingMode {vk::SharingMode::eExclusive},
+      },
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+  std::tie(index_buf, index_alloc) = allocator.createBuffer(
+      {
+          .size {opts.index_buffer_size},
+          .usage {vk::BufferUsageFlagBits::eIndexBuffer |
+                  vk::BufferUsageFlagBits::eTransferDst},
+          .sharingMode {vk::SharingMode::eExclusive},
+      },
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+  std::tie(instance_buf, instance_alloc) = allocator.createBuffer(
+      {
+          .size {opts.instance_buffer_size},
+          .usage {vk::BufferUsageFlagBits::eStorageBuffer |
+                  vk::BufferUsageFlagBits::eTransferDst},
+          .sharingMode {vk::SharingMode::eExclusive},
+      },
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+}
+
+void Renderer::destroyGeometryBuffers() {
+  allocator.destroy(vertex_buf, vertex_alloc);
+  allocator.destroy(index_buf, index_alloc);
+  allocator.destroy(instance_buf, instance_alloc);
+}
+
+void Renderer::createUploadResources() {
+  staging = StagingRing {allocator, opts.staging_size};
+  upload_pool = dev.createCommandPool({
+      .flags {vk::CommandPoolCreateFlagBits::eTransient |
+              vk::CommandPoolCreateFlagBits::eResetCommandBuffer},
+      .queueFamilyIndex {rend_group.xfer_qfam_idx},
+  });
+
+  const vk::SemaphoreTypeCreateInfo type_info {
+      .semaphoreType {vk::SemaphoreType::eTimeline},
+      .initialValue {0},
+  };
+  upload_timeline = dev.createSemaphore({.pNext {&type_info}});
+}
+
+void Renderer::destroyUploadResources() {
+  upload_open.reset();
+  upload_inflight.clear();
+  upload_free.clear();
+
+  dev.destroy(upload_timeline);
+  dev.destroy(upload_pool);
+  staging.destroy(allocator);
+}
+
+vk::CommandBuffer Renderer::beginUploads() {
+  if(upload_open)
+    return upload_open->cmd;
+
+  if(upload_free.empty())
+    upload_open = UploadBatch {
+        .cmd {dev.allocateCommandBuffers({
+            .commandPool {upload_pool},
+            .commandBufferCount {1},
+        })[0]},
+    };
+  else {
+    upload_open = upload_free.back();
+    upload_free.pop_back();
+  }
+
+  upload_open->id = upload_next_id++;
+  upload_open->cmd.begin(
+      {.flags {vk::CommandBufferUsageFlagBits::eOneTimeSubmit}});
+  return upload_open->cmd;
+}
+
+void Renderer::uploadBuffer(vk::Buffer dst, vk::DeviceSize dst_offset,
+    std::span<const std::byte> data) {
+  const vk::DeviceSize max_chunk {staging.capacity() / 2};
+  while(!data.empty()) {
+    const auto chunk {std::min<vk::DeviceSize>(data.size(), max_chunk)};
+    auto offset {staging.allocate(chunk, 16)};
+    while(!offset) {
+      flushUploads();
+      retireUploads(true);
+      offset = staging.allocate(chunk, 16);
+    }
+
+    std::memcpy(staging.getMapped(*offset), data.data(), chunk);
+    beginUploads().copyBuffer(staging.getBuffer(), dst,
+        vk::BufferCopy {
+            .srcOffset {*offset},
+            .dstOffset {dst_offset},
+            .size {chunk},
+        });
+    if(!upload_regions.empty() && upload_regions.back().buffer == dst &&
+        upload_regions.back().offset + upload_regions.back().size ==
+            dst_offset)
+      upload_regions.back().size += chunk;
+    else
+      upload_regions.push_back({
+          .srcAccessMask {vk::AccessFlagBits::eTransferWrite},
+          .dstAccessMask {upload_dst_access},
+          .srcQueueFamilyIndex {rend_group.xfer_qfam_idx},
+          .dstQueueFamilyIndex {rend_group.qfam_idx},
+          .buffer {dst},
+          .offset {dst_offset},
+          .size {chunk},
+      });
+    data = data.subspan(chunk);
+    dst_offset += chunk;
+  }
+}
+
+void Renderer::uploadImage(vk::Image dst, vk::Extent2D size,
+    std::span<const std::byte> data) {
+  const vk::DeviceSize row_size {data.size() / size.height};
+  const vk::DeviceSize max_rows {staging.capacity() / 2 / row_size};
+  if(max_rows == 0)
+    throw std::runtime_error {"image row exceeds staging capacity"};
+
+  beginUploads().pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+      vk::ImageMemoryBarrier {
+          .dstAccessMask {vk::AccessFlagBits::eTransferWrite},
+          .oldLayout {vk::ImageLayout::eUndefined},
+          .newLayout {vk::ImageLayout::eTransferDstOptimal},
+          .srcQueueFamilyIndex {VK_QUEUE_FAMILY_IGNORED},
+          .dstQueueFamilyIndex {VK_QUEUE_FAMILY_IGNORED},
+          .image {dst},
+          .subresourceRange {color_range},
+      });
+
+  std::uint32_t row {0};
+  while(row < size.height) {
+    const auto rows {static_cast<std::uint32_t>(
+        std::min<vk::DeviceSize>(size.height - row, max_rows))};
+    const auto chunk {rows * row_size};
+    auto offset {staging.allocate(chunk, 16)};
+    while(!offset) {
+      flushUploads();
+      retireUploads(true);
+      offset = staging.allocate(chunk, 16);
+    }
+
+    std::memcpy(staging.getMapped(*offset), data.data() + row * row_size,
+        chunk);
+    beginUploads().copyBufferToImage(staging.getBuffer(), dst,
+        vk::ImageLayout::eTransferDstOptimal,
+        vk::BufferImageCopy {
+            .bufferOffset {*offset},
+            .imageSubresource {
+                .aspectMask {vk::ImageAspectFlagBits::eColor},
+                .layerCount {1},
+            },
+            .imageOffset {0, static_cast<std::int32_t>(row), 0},
+            .imageExtent {size.width, rows, 1},
+        });
+    row += rows;
+  }
+  upload_images.push_back({
+      .srcAccessMask {vk::AccessFlagBits::eTransferWrite},
+      .dstAccessMask {vk::AccessFlagBits::eShaderRead},
+      .oldLayout {vk::ImageLayout::eTransferDstOptimal},
+      .newLayout {vk::ImageLayout::eShaderReadOnlyOptimal},
+      .srcQueueFamilyIndex {rend_group.xfer_qfam_idx},
+      .dstQueueFamilyIndex {rend_group.qfam_idx},
+      .image {dst},
+      .subresourceRange {color_range},
+  });
+}
+
+void Renderer::flushUploads() {
+  if(!upload_open)
+    return;
+
+  auto& batch {*upload_open};
+  if(rend_group.xfer_qfam_idx == rend_group.qfam_idx)
+    batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        upload_dst_stages, {},
+        vk::MemoryBarrier {
+            .srcAccessMask {vk::AccessFlagBits::eTransferWrite},
+            .dstAccessMask {upload_dst_access},
+        },
+        {}, upload_images);
+  else {
+    for(auto& region : upload_regions) {
+      auto acquire {region};
+      acquire.srcAccessMask = {};
+      pending_acquires.push_back(acquire);
+      region.dstAccessMask = {};
+    }
+    for(auto& image : upload_images) {
+      auto acquire {image};
+      acquire.srcAccessMask = {};
+      pending_image_acquires.push_back(acquire);
+      image.dstAccessMask = {};
+    }
+    batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, upload_regions,
+        upload_images);
+  }
+  upload_regions.clear();
+  upload_images.clear();
+  batch.cmd.end();
+
+  const vk::TimelineSemaphoreSubmitInfo timeline_info {
+      .signalSemaphoreValueCount {1},
+      .pSignalSemaphoreValues {&batch.id},
+  };
+  xfer_q.submit(
+      vk::SubmitInfo {
+          .pNext {&timeline_info},
+          .commandBufferCount {1},
+          .pCommandBuffers {&batch.cmd},
+          .signalSemaphoreCount {1},
+          .pSignalSemaphores {&upload_timeline},
+      },
+      {});
+
+  staging.close(batch.id);
+  upload_wait_value = batch.id;
+  upload_inflight.push_back(batch);
+  upload_open.reset();
+}
+
+void Renderer::retireUploads(bool wait_oldest) {
+  if(wait_oldest && !upload_inflight.empty()) {
+    const auto value {upload_inflight.front().id};
+    if(dev.waitSemaphores(
+           {
+               .semaphoreCount {1},
+               .pSemaphores {&upload_timeline},
+               .pValues {&value},
+           },
+           UINT64_MAX) != vk::Result::eSuccess)
+      throw std::runtime_error {"wait failure or timeout"};
+  }
+
+  const auto completed {dev.getSemaphoreCounterValue(upload_timeline)};
+  staging.retire(completed);
+  while(!upload_inflight.empty() && upload_inflight.front().id <= completed) {
+    upload_free.push_back(upload_inflight.front());
+    upload_inflight.pop_front();
+  }
+}
+
+void Renderer::createBindless() {
+  const auto props {
+      rend_group.dev
+          .getProperties2<vk::PhysicalDeviceProperties2,
+              vk::PhysicalDeviceVulkan12Properties>()
+          .get<vk::PhysicalDeviceVulkan12Properties>()};
+  bindless_slots[0].capacity = std::min({opts.bindless_textures,
+      props.maxDescriptorSetUpdateAfterBindSampledImages,
+      props.maxPerStageDescriptorUpdateAfterBindSampledImages});
+  bindless_slots[1].capacity = std::min({opts.bindless_buffers,
+      props.maxDescriptorSetUpdateAfterBindStorageBuffers,
+      props.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+  bindless_slots[2].capacity = std::min({opts.bindless_samplers,
+      props.maxDescriptorSetUpdateAfterBindSamplers,
+      props.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+  const std::array<vk::DescriptorType, 3> types {
+      vk::DescriptorType::eSampledImage,
+      vk::DescriptorType::eStorageBuffer,
+      vk::DescriptorType::eSampler,
+  };
+  std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+  std::array<vk::DescriptorPoolSize, 3> sizes;
+  for(std::uint32_t i {0}; i < types.size(); i++) {
+    bindings[i] = {
+        .binding {i},
+        .descriptorType {types[i]},
+        .descriptorCount {bindless_slots[i].capacity},
+        .stageFlags {vk::ShaderStageFlagBits::eVertex |
+                     vk::ShaderStageFlagBits::eFragment |
+                     vk::ShaderStageFlagBits::eCompute},
+    };
+    sizes[i] = {
+        .type {types[i]},
+        .descriptorCount {bindless_slots[i].capacity},
+    };
+  }
+
+  const vk::DescriptorBindingFlags flags {
+      vk::DescriptorBindingFlagBits::ePartiallyBound |
+      vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+      vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending};
+  const std::array binding_flags {flags, flags, flags};
+  const vk::DescriptorSetLayoutBindingFlagsCreateInfo flags_info {
+      .bindingCount {binding_flags.size()},
+      .pBindingFlags {binding_flags.data()},
+  };
+  bindless_layout = dev.createDescriptorSetLayout({
+      .pNext {&flags_info},
+      .flags {vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool},
+      .bindingCount {bindings.size()},
+      .pBindings {bindings.data()},
+  });
+  bindless_pool = dev.createDescriptorPool({
+      .flags {vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind},
+      .maxSets {1},
+      .poolSizeCount {sizes.size()},
+      .pPoolSizes {sizes.data()},
+  });
+  bindless_set = dev.allocateDescriptorSets({
+      .descriptorPool {bindless_pool},
+      .descriptorSetCount {1},
+      .pSetLayouts {&bindless_layout},
+  })[0];
+
+  default_sampler = dev.createSampler({
+      .magFilter {vk::Filter::eLinear},
+      .minFilter {vk::Filter::eLinear},
+      .mipmapMode {vk::SamplerMipmapMode::eLinear},
+      .addressModeU {vk::SamplerAddressMode::eRepeat},
+      .addressModeV {vk::SamplerAddressMode::eRepeat},
+      .addressModeW {vk::SamplerAddressMode::eRepeat},
+      .maxLod {VK_LOD_CLAMP_NONE},
+  });
+  registerSampler(default_sampler);
+  instance_idx = registerBuffer(instance_buf);
+}
+
+void Renderer::destroyBindless() {
+  for(auto& [idx, tex] : textures) {
+    dev.destroy(tex.view);
+    allocator.destroy(tex.image, tex.alloc);
+  }
+  textures.clear();
+
+  dev.destroy(default_sampler);
+  dev.destroy(bindless_pool);
+  dev.destroy(bindless_layout);
+  bindless_slots = {};
+}
+
+std::uint32_t Renderer::acquireBindless(BindlessType type) {
+  auto& slots {bindless_slots[static_cast<std::uint32_t>(type)]};
+  if(!slots.retired.empty()) {
+    const auto completed {getCompletedFrame()};
+    while(!slots.retired.empty() &&
+        slots.retired.front().first <= completed) {
+      slots.free.push_back(slots.retired.front().second);
+      slots.retired.pop_front();
+    }
+  }
+
+  if(!slots.free.empty()) {
+    const auto idx {slots.free.back()};
+    slots.free.pop_back();
+    return idx;
+  }
+  if(slots.next == slots.capacity)
+    throw std::runtime_error {"bindless descriptor slots exhausted"};
+  return slots.next++;
+}
+
+void Renderer::releaseBindless(BindlessType type, std::uint32_t idx) {
+  auto& slots {bindless_slots[static_cast<std::uint32_t>(type)]};
+  slots.retired.emplace_back(frame_count + 1, idx);
+}
+
+std::uint32_t Renderer::registerTexture(vk::ImageView view) {
+  const auto idx {acquireBindless(BindlessType::eTexture)};
+  const vk::DescriptorImageInfo info {
+      .imageView {view},
+      .imageLayout {vk::ImageLayout::eShaderReadOnlyOptimal},
+  };
+  dev.updateDescriptorSets(
+      vk::WriteDescriptorSet {
+          .dstSet {bindless_set},
+          .dstBinding {0},
+          .dstArrayElement {idx},
+          .descriptorCount {1},
+          .descriptorType {vk::DescriptorType::eSampledImage},
+          .pImageInfo {&info},
+      },
+      {});
+  return idx;
+}
+
+std::uint32_t Renderer::registerBuffer(
+    vk::Buffer buf, vk::DeviceSize offset, vk::DeviceSize range) {
+  const auto idx {acquireBindless(BindlessType::eBuffer)};
+  const vk::DescriptorBufferInfo info {
+      .buffer {buf},
+      .offset {offset},
+      .range {range},
+  };
+  dev.updateDescriptorSets(
+      vk::WriteDescriptorSet {
+          .dstSet {bindless_set},
+          .dstBinding {1},
+          .dstArrayElement {idx},
+          .descriptorCount {1},
+          .descriptorType {vk::DescriptorType::eStorageBuffer},
+          .pBufferInfo {&info},
+      },
+      {});
+  return idx;
+}
+
+std::uint32_t Renderer::registerSampler(vk::Sampler sampler) {
+  const auto idx {acquireBindless(BindlessType::eSampler)};
+  const vk::DescriptorImageInfo info {.sampler {sampler}};
+  dev.updateDescriptorSets(
+      vk::WriteDescriptorSet {
+          .dstSet {bindless_set},
+          .dstBinding {2},
+          .dstArrayElement {idx},
+          .descriptorCount {1},
+          .descriptorType {vk::DescriptorType::eSampler},
+          .pImageInfo {&info},
+      },
+      {});
+  return idx;
+}
+
+std::uint32_t Renderer::createTexture(std::uint32_t width,
+    std::uint32_t height, std::span<const std::uint8_t> rgba) {
+  if(width == 0 || height == 0)
+    throw std::runtime_error {"texture extent is empty"};
+  if(rgba.size() != std::size_t {width} * height * 4)
+    throw std::runtime_error {"texture data does not match extent"};
+
+  Texture tex;
+  std::tie(tex.image, tex.alloc) = allocator.createImage(
+      {
+          .imageType {vk::ImageType::e2D},
+          .format {vk::Format::eR8G8B8A8Srgb},
+          .extent {width, height, 1},
+          .mipLevels {1},
+          .arrayLayers {1},
+          .samples {vk::SampleCountFlagBits::e1},
+          .tiling {vk::ImageTiling::eOptimal},
+          .usage {vk::ImageUsageFlagBits::eSampled |
+                  vk::ImageUsageFlagBits::eTransferDst},
+          .sharingMode {vk::SharingMode::eExclusive},
+          .initialLayout {vk::ImageLayout::eUndefined},
+      },
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+  uploadImage(tex.image, {width, height}, std::as_bytes(rgba));
+  tex.view = dev.createImageView({
+      .image {tex.image},
+      .viewType {vk::ImageViewType::e2D},
+      .format {vk::Format::eR8G8B8A8Srgb},
+      .subresourceRange {color_range},
+  });
+
+  const auto idx {registerTexture(tex.view)};
+  textures.emplace(idx, tex);
+  return idx;
+}
+
+void Renderer::destroyTexture(std::uint32_t texture) {
+  auto it {textures.find(texture)};
+  if(it == textures.end())
+    throw std::runtime_error {"unknown texture"};
+
+  flushUploads();
+  releaseBindless(BindlessType::eTexture, texture);
+  deletions.push(frame_count + 1, [this, tex {it->second}] {
+    dev.destroy(tex.view);
+    allocator.destroy(tex.image, tex.alloc);
+  });
+  textures.erase(it);
 }
 
 void Renderer::createImageViews() {
@@ -327,54 +2718,78 @@ void Renderer::createImageViews() {
     });
 }
 
-void Renderer::createRenderPass() {
-  vk::AttachmentDescription attach_dec {
-      .format {format.format},
-      .samples {vk::SampleCountFlagBits::e1},
-      .stencilLoadOp {vk::AttachmentLoadOp::eDontCare},
-      .stencilStoreOp {vk::AttachmentStoreOp::eDontCare},
-      .finalLayout {vk::ImageLayout::ePresentSrcKHR},
-  };
-
-  vk::AttachmentReference attach_ref {
-      .attachment {0},
-      .layout {vk::ImageLayout::eColorAttachmentOptimal},
-  };
+std::string defaultPipelineCachePath() {
+  std::filesystem::path dir;
+  if(const char* xdg {std::getenv("XDG_CACHE_HOME")}; xdg && *xdg)
+    dir = xdg;
+  else if(const char* home {std::getenv("HOME")}; home && *home)
+    dir = std::filesystem::path {home} / ".cache";
+  else
+    return {};
+  return (dir / "vgfx" / "pipeline_cache").string();
+}
 
-  vk::SubpassDescription subpass_desc {
-      .colorAttachmentCount {1},
-      .pColorAttachments {&attach_ref},
-  };
+void Renderer::createPipelineCache() {
+  std::vector<char> data;
+  try {
+    if(!opts.pipeline_cache_path.empty() &&
+        std::filesystem::exists(opts.pipeline_cache_path))
+      data = readFile(opts.pipeline_cache_path);
+  } catch(const std::exception& err) {
+    opts.logger(LogSeverity::eWarning,
+        std::string {"ignoring pipeline cache: "} + err.what());
+    data.clear();
+  }
 
-  vk::SubpassDependency subpass_dep {
-      .srcSubpass {VK_SUBPASS_EXTERNAL},
-      .dstSubpass {0},
-      .srcStageMask {vk::PipelineStageFlagBits::eColorAttachmentOutput},
-      .dstStageMask {vk::PipelineStageFlagBits::eColorAttachmentOutput},
-      .dstAccessMask {vk::AccessFlagBits::eColorAttachmentWrite},
-  };
+  const auto header {getPipelineCacheHeader(rend_group.dev)};
+  if(data.size() < sizeof(header) ||
+      std::memcmp(data.data(), &header, sizeof(header)))
+    data.clear();
+  else
+    data.erase(data.begin(), data.begin() + sizeof(header));
 
-  render_pass = dev.createRenderPass({
-      .attachmentCount {1},
-      .pAttachments {&attach_dec},
-      .subpassCount {1},
-      .pSubpasses {&subpass_desc},
-      .dependencyCount {1},
-      .pDependencies {&subpass_dep},
+  pipeline_cache = dev.createPipelineCache({
+      .initialDataSize {data.size()},
+      .pInitialData {data.data()},
   });
 }
 
-void Renderer::createPipeline() {
-  auto vert_code {readFile("shaders/shader.vert.spv")};
-  auto frag_code {readFile("shaders/shader.frag.spv")};
+void Renderer::savePipelineCache() {
+  if(opts.pipeline_cache_path.empty())
+    return;
+
+  const auto header {getPipelineCacheHeader(rend_group.dev)};
+  const std::string tmp_path {opts.pipeline_cache_path + ".tmp"};
+  try {
+    const auto data {dev.getPipelineCacheData(pipeline_cache)};
+    const auto dir {
+        std::filesystem::path {opts.pipeline_cache_path}.parent_path()};
+    if(!dir.empty())
+      std::filesystem::create_directories(dir);
+    {
+      std::ofstream ofs {tmp_path, std::ios::binary | std::ios::trunc};
+      if(!ofs)
+        throw std::runtime_error {"failed to open file: " + tmp_path};
+      ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+      if(!ofs)
+        throw std::runtime_error {"failed to write file: " + tmp_path};
+    }
+    std::filesystem::rename(tmp_path, opts.pipeline_cache_path);
+  } catch(const std::exception& err) {
+    opts.logger(LogSeverity::eWarning,
+        std::string {"failed to save pipeline cache: "} + err.what());
+  }
+}
 
+void Renderer::createPipeline() {
   auto vert_module {dev.createShaderModule({
-      .codeSize {vert_code.size()},
-      .pCode {reinterpret_cast<const std::uint32_t*>(vert_code.data())},
+      .codeSize {sizeof(shaders::shader_vert)},
+      .pCode {shaders::shader_vert},
   })};
   auto frag_module {dev.createShaderModule({
-      .codeSize {frag_code.size()},
-      .pCode {reinterpret_cast<const std::uint32_t*>(frag_code.data())},
+      .codeSize {sizeof(shaders::shader_frag)},
+      .pCode {shaders::shader_frag},
   })};
 
   std::array shader_stages {
@@ -390,27 +2805,57 @@ void Renderer::createPipeline() {
       },
   };
 
-  vk::PipelineVertexInputStateCreateInfo pipe_vert_info {};
+  vk::VertexInputBindingDescription vert_binding {
+      .binding {0},
+      .stride {sizeof(Vertex)},
+      .inputRate {vk::VertexInputRate::eVertex},
+  };
 
-  vk::PipelineInputAssemblyStateCreateInfo pipe_input_asm_info {
-      .topology {vk::PrimitiveTopology::eTriangleList},
+  std::array vert_attrs {
+      vk::VertexInputAttributeDescription {
+          .location {0},
+          .binding {0},
+          .format {vk::Format::eR32G32B32Sfloat},
+          .offset {offsetof(Vertex, pos)},
+      },
+      vk::VertexInputAttributeDescription {
+          .location {1},
+          .binding {0},
+          .format {vk::Format::eR32G32B32Sfloat},
+          .offset {offsetof(Vertex, color)},
+      },
+      vk::VertexInputAttributeDescription {
+          .location {2},
+          .binding {0},
+          .format {vk::Format::eR32G32Sfloat},
+          .offset {offsetof(Vertex, uv)},
+      },
   };
 
-  vk::Viewport viewport {
-      .width {static_cast<float>(extent.width)},
-      .height {static_cast<float>(extent.height)},
-      .maxDepth {1.0f},
+  vk::PipelineVertexInputStateCreateInfo pipe_vert_info {
+      .vertexBindingDescriptionCount {1},
+      .pVertexBindingDescriptions {&vert_binding},
+      .vertexAttributeDescriptionCount {vert_attrs.size()},
+      .pVertexAttributeDescriptions {vert_attrs.data()},
   };
 
-  vk::Rect2D scissor {
-      .extent {extent},
+  vk::PipelineInputAssemblyStateCreateInfo pipe_input_asm_info {
+      .topology {vk::PrimitiveTopology::eTriangleList},
   };
 
   vk::PipelineViewportStateCreateInfo viewport_state {
       .viewportCount {1},
-      .pViewports {&viewport},
       .scissorCount {1},
-      .pScissors {&scissor},
+  };
+
+  std::array dynamic_states {
+      vk::DynamicState::eViewport,
+      vk::DynamicState::eScissor,
+  };
+
+  vk::PipelineDynamicStateCreateInfo dynamic_state {
+      .dynamicStateCount {dynamic_states.size()},
+      .pDynamicStates {dynamic_states.data()},
   };
 
   vk::PipelineRasterizationStateCreateInfo rast_state {
@@ -424,6 +2869,12 @@ void Renderer::createPipeline() {
       .minSampleShading {1.0f},
   };
 
+  vk::PipelineDepthStencilStateCreateInfo depth_state {
+      .depthTestEnable {true},
+      .depthWriteEnable {true},
+      .depthCompareOp {vk::CompareOp::eLessOrEqual},
+  };
+
   vk::PipelineColorBlendAttachmentState color_blend_attach {
       .colorWriteMask {
           vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
@@ -435,10 +2886,27 @@ void Renderer::createPipeline() {
       .pAttachments {&color_blend_attach},
   };
 
-  layout = dev.createPipelineLayout({});
+  const vk::PushConstantRange push_range {
+      .stageFlags {vk::ShaderStageFlagBits::eVertex |
+                   vk::ShaderStageFlagBits::eFragment},
+      .size {view_proj_offset + sizeof(view_proj)},
+  };
+  layout = dev.createPipelineLayout({
+      .setLayoutCount {1},
+      .pSetLayouts {&bindless_layout},
+      .pushConstantRangeCount {1},
+      .pPushConstantRanges {&push_range},
+  });
+  const std::array color_formats {format.format};
+  const vk::PipelineRenderingCreateInfoKHR rendering_info {
+      .colorAttachmentCount {color_formats.size()},
+      .pColorAttachmentFormats {color_formats.data()},
+      .depthAttachmentFormat {depth_format},
+  };
 
   // clang-format off
-  pipeline = dev.createGraphicsPipeline(VK_NULL_HANDLE, {
+  pipeline = dev.createGraphicsPipeline(pipeline_cache, {
+      .pNext {dynamic_rendering ? &rendering_info : nullptr},
       .stageCount {shader_stages.size()},
       .pStages {shader_stages.data()},
       .pVertexInputState {&pipe_vert_info},
@@ -446,9 +2914,13 @@ void Renderer::createPipeline() {
       .pViewportState {&viewport_state},
       .pRasterizationState {&rast_state},
       .pMultisampleState {&mm_sample},
+      .pDepthStencilState {&depth_state},
       .pColorBlendState {&color_blend_state},
+      .pDynamicState {&dynamic_state},
       .layout {layout},
-      .renderPass {render_pass},
+      .renderPass {dynamic_rendering
+          ? vk::RenderPass {}
+          : graph.getRenderPass(color_formats, depth_format)},
   }).value;
   // clang-format on
 
@@ -456,53 +2928,477 @@ void Renderer::createPipeline() {
   dev.destroy(frag_module);
 }
 
-void Renderer::createFramebuffers() {
-  framebuffers.resize(image_views.size());
-  for(size_t i {0}; i < image_views.size(); i++)
-    framebuffers[i] = dev.createFramebuffer({
-        .renderPass {render_pass},
-        .attachmentCount {1},
-        .pAttachments {&image_views[i]},
-        .width {extent.width},
-        .height {extent.height},
-        .layers {1},
+void Renderer::createFrameResources() {
+  frame_pools.resize(frames_in_flight);
+  frame_cmds.resize(frames_in_flight);
+  image_available.resize(frames_in_flight);
+  frame_values.assign(frames_in_flight, 0);
+
+  for(size_t i {0}; i < frames_in_flight; i++) {
+    image_available[i] = dev.createSemaphore({});
+    frame_pools[i] = dev.createCommandPool({
+        .flags {vk::CommandPoolCreateFlagBits::eTransient},
+        .queueFamilyIndex {rend_group.qfam_idx},
     });
+    frame_cmds[i] = dev.allocateCommandBuffers({
+        .commandPool {frame_pools[i]},
+        .commandBufferCount {1},
+    })[0];
+  }
 }
 
-void Renderer::recordCommandBuffers() {
-  const vk::ClearValue clear_color {std::array {0.0f, 0.0f, 0.0f, 1.0f}};
-  for(size_t i {0}; i < cmd_bufs.size(); i++) {
-    cmd_bufs[i].begin(vk::CommandBufferBeginInfo {});
-    cmd_bufs[i].beginRenderPass(
+void Renderer::recordCommandBuffer(
+    vk::CommandBuffer cmd, std::uint32_t img_idx) {
+  const bool parallel {jobs && draw_list.size() > opts.draws_per_job};
+
+  cmd.begin({.flags {vk::CommandBufferUsageFlagBits::eOneTimeSubmit}});
+  const auto query {static_cast<std::uint32_t>(2 * frame_idx)};
+  if(timestamp_pool)
+    cmd.resetQueryPool(timestamp_pool, query, 2);
+  if(!pending_acquires.empty() || !pending_image_acquires.empty())
+    cmd.pipelineBarrier(upload_dst_stages, upload_dst_stages, {}, {},
+        pending_acquires, pending_image_acquires);
+
+  graph.reset();
+  const auto color {graph.importImage(images[img_idx], image_views[img_idx],
+      {
+          .format {format.format},
+          .extent {extent},
+          .usage {vk::ImageUsageFlagBits::eColorAttachment},
+      },
+      {.stages {vk::PipelineStageFlagBits::eColorAttachmentOutput}},
+      headless() ? GraphAccess {}
+                 : GraphAccess {
+                       .stages {vk::PipelineStageFlagBits::eBottomOfPipe},
+                       .layout {vk::ImageLayout::ePresentSrcKHR},
+                   })};
+  const auto depth {graph.createImage({
+      .format {depth_format},
+      .extent {extent},
+      .usage {vk::ImageUsageFlagBits::eDepthStencilAttachment},
+      .aspect {depth_format == vk::Format::eD32Sfloat
+              ? vk::ImageAspectFlags {vk::ImageAspectFlagBits::eDepth}
+              : vk::ImageAspectFlagBits::eDepth |
+                  vk::ImageAspectFlagBits::eStencil},
+  })};
+
+  std::vector<RenderGraph::Use> draw_uses;
+  if(object_draw && object_count) {
+    const GraphAccess last_draw {
+        .stages {vk::PipelineStageFlagBits::eDrawIndirect |
+                 vk::PipelineStageFlagBits::eVertexShader},
+    };
+    const auto objects {graph.importBuffer(object_buf)};
+    const auto visible {graph.importBuffer(visible_buf, last_draw)};
+    const auto commands {graph.importBuffer(indirect_buf, last_draw)};
+    const auto count {graph.importBuffer(count_buf, last_draw)};
+
+    graph.addPass("clear-count",
+        {{count,
+            {
+                .stages {vk::PipelineStageFlagBits::eTransfer},
+                .access {vk::AccessFlagBits::eTransferWrite},
+            }}},
+        [&](vk::CommandBuffer cmd, const RenderTarget&) {
+          cmd.fillBuffer(count_buf, 0, sizeof(std::uint32_t), 0);
+        });
+
+    const auto compute {[](vk::AccessFlags access) {
+      return GraphAccess {
+          .stages {vk::PipelineStageFlagBits::eComputeShader},
+          .access {access},
+      };
+    }};
+    graph.addPass("cull",
+        {
+            {objects, compute(vk::AccessFlagBits::eShaderRead)},
+            {visible, compute(vk::AccessFlagBits::eShaderWrite)},
+            {commands, compute(vk::AccessFlagBits::eShaderWrite)},
+            {count, compute(vk::AccessFlagBits::eShaderRead |
+                            vk::AccessFlagBits::eShaderWrite)},
+        },
+        [&](vk::CommandBuffer cmd, const RenderTarget&) { recordCull(cmd); });
+
+    const GraphAccess indirect {
+        .stages {vk::PipelineStageFlagBits::eDrawIndirect},
+        .access {vk::AccessFlagBits::eIndirectCommandRead},
+    };
+    draw_uses = {
+        {visible,
+            {
+                .stages {vk::PipelineStageFlagBits::eVertexShader},
+                .access {vk::AccessFlagBits::eShaderRead},
+            }},
+        {commands, indirect},
+        {count, indirect},
+    };
+  }
+
+  graph.addRenderPass("main",
+      {{
+          .image {color},
+          .clear {std::array {0.0f, 0.0f, 0.0f, 1.0f}},
+      }},
+      GraphAttachment {
+          .image {depth},
+          .clear {vk::ClearDepthStencilValue {1.0f, 0}},
+      },
+      std::move(draw_uses),
+      parallel ? vk::SubpassContents::eSecondaryCommandBuffers
+               : vk::SubpassContents::eInline,
+      [&](vk::CommandBuffer cmd, const RenderTarget& target) {
+        if(parallel) {
+          recordSecondaries(target);
+          cmd.executeCommands(secondaries);
+        } else {
+          recordDraws(cmd, draw_list);
+          recordObjects(cmd);
+        }
+      });
+  if(timestamp_pool)
+    graph.timePass("main", timestamp_pool, query);
+
+  if(headless()) {
+    const auto readback {graph.importBuffer(readback_bufs[img_idx], {},
+        {
+            .stages {vk::PipelineStageFlagBits::eHost},
+            .access {vk::AccessFlagBits::eHostRead},
+        })};
+    graph.addPass("readback",
         {
-            .renderPass {render_pass},
-            .framebuffer {framebuffers[i]},
-            .renderArea {.extent {extent}},
-            .clearValueCount {1},
-            .pClearValues {&clear_color},
+            {color,
+                {
+                    .stages {vk::PipelineStageFlagBits::eTransfer},
+                    .access {vk::AccessFlagBits::eTransferRead},
+                    .layout {vk::ImageLayout::eTransferSrcOptimal},
+                }},
+            {readback,
+                {
+                    .stages {vk::PipelineStageFlagBits::eTransfer},
+                    .access {vk::AccessFlagBits::eTransferWrite},
+                }},
         },
-        vk::SubpassContents::eInline);
+        [&](vk::CommandBuffer cmd, const RenderTarget&) {
+          cmd.copyImageToBuffer(images[img_idx],
+              vk::ImageLayout::eTransferSrcOptimal, readback_bufs[img_idx],
+              vk::BufferImageCopy {
+                  .imageSubresource {
+                      .aspectMask {vk::ImageAspectFlagBits::eColor},
+                      .layerCount {1},
+                  },
+                  .imageExtent {extent.width, extent.height, 1},
+              });
+        });
+  }
+  graph.execute(cmd, frame_count);
+  cmd.end();
+}
 
-    cmd_bufs[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-    cmd_bufs[i].draw(3, 1, 0, 0);
-    cmd_bufs[i].endRenderPass();
+void Renderer::bindDrawState(vk::CommandBuffer cmd) {
+  cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+  cmd.setViewport(0,
+      vk::Viewport {
+          .width {static_cast<float>(extent.width)},
+          .height {static_cast<float>(extent.height)},
+          .maxDepth {1.0f},
+      });
+  cmd.setScissor(0, vk::Rect2D {.extent {extent}});
+  cmd.bindVertexBuffers(0, vertex_buf, vk::DeviceSize {0});
+  cmd.bindIndexBuffer(index_buf, 0, vk::IndexType::eUint32);
+  cmd.bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics, layout, 0, bindless_set, {});
+  cmd.pushConstants<float>(layout,
+      vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+      view_proj_offset, view_proj);
+}
 
-    cmd_bufs[i].end();
+void Renderer::recordDraws(
+    vk::CommandBuffer cmd, std::span<const DrawCommand> draws) {
+  bindDrawState(cmd);
+  for(const auto& draw_cmd : draws) {
+    cmd.pushConstants<DrawPush>(layout,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0, draw_cmd.resources);
+    cmd.drawIndexed(draw_cmd.mesh.index_count, draw_cmd.instance_count,
+        draw_cmd.mesh.first_index, draw_cmd.mesh.vertex_offset,
+        draw_cmd.first_instance);
   }
 }
 
-void Renderer::createSyncPrimitives() {
-  image_available.resize(img_count);
-  render_finished.resize(img_count);
-  frame_inflight.resize(img_count);
-  image_inflight.resize(img_count);
+void Renderer::createCullResources() {
+  const auto create {[&](vk::DeviceSize size, vk::BufferUsageFlags usage) {
+    return allocator.createBuffer(
+        {
+            .size {size},
+            .usage {usage | vk::BufferUsageFlagBits::eStorageBuffer},
+            .sharingMode {vk::SharingMode::eExclusive},
+        },
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+  }};
+  const vk::DeviceSize max_objects {opts.max_objects};
+  std::tie(object_buf, object_alloc) = create(max_objects * sizeof(GpuObject),
+      vk::BufferUsageFlagBits::eTransferDst);
+  std::tie(visible_buf, visible_alloc) =
+      create(max_objects * sizeof(Instance), {});
+  std::tie(indirect_buf, indirect_alloc) =
+      create(max_objects * sizeof(vk::DrawIndexedIndirectCommand),
+          vk::BufferUsageFlagBits::eIndirectBuffer);
+  std::tie(count_buf, count_alloc) = create(sizeof(std::uint32_t),
+      vk::BufferUsageFlagBits::eIndirectBuffer |
+          vk::BufferUsageFlagBits::eTransferDst);
+  object_idx = registerBuffer(object_buf);
+  visible_idx = registerBuffer(visible_buf);
+  indirect_idx = registerBuffer(indirect_buf);
+  count_idx = registerBuffer(count_buf);
+
+  const vk::PushConstantRange push_range {
+      .stageFlags {vk::ShaderStageFlagBits::eCompute},
+      .size {sizeof(CullPush)},
+  };
+  cull_layout = dev.createPipelineLayout({
+      .setLayoutCount {1},
+      .pSetLayouts {&bindless_layout},
+      .pushConstantRangeCount {1},
+      .pPushConstantRanges {&push_range},
+  });
 
-  for(size_t i {0}; i < img_count; i++) {
-    image_available[i] = dev.createSemaphore({});
-    render_finished[i] = dev.createSemaphore({});
-    frame_inflight[i] =
-        dev.createFence({.flags {vk::FenceCreateFlagBits::eSignaled}});
+  auto comp_module {dev.createShaderModule({
+      .codeSize {sizeof(shaders::cull_comp)},
+      .pCode {shaders::cull_comp},
+  })};
+  // clang-format off
+  cull_pipeline = dev.createComputePipeline(pipeline_cache, {
+      .stage {
+          .stage {vk::ShaderStageFlagBits::eCompute},
+          .module {comp_module},
+          .pName {"main"},
+      },
+      .layout {cull_layout},
+  }).value;
+  // clang-format on
+  dev.destroy(comp_module);
+
+  setViewProjection(view_proj);
+}
+
+void Renderer::destroyCullResources() {
+  dev.destroy(cull_pipeline);
+  dev.destroy(cull_layout);
+  allocator.destroy(object_buf, object_alloc);
+  allocator.destroy(visible_buf, visible_alloc);
+  allocator.destroy(indirect_buf, indirect_alloc);
+  allocator.destroy(count_buf, count_alloc);
+  object_count = 0;
+}
+
+std::uint32_t Renderer::addObject(const Object& object) {
+  return addObjects(std::span {&object, 1});
+}
+
+std::uint32_t Renderer::addObjects(std::span<const Object> objects) {
+  if(objects.size() > opts.max_objects - object_count)
+    throw std::runtime_error {"object buffer exhausted"};
+
+  std::vector<GpuObject> gpu_objects;
+  gpu_objects.reserve(objects.size());
+  for(const auto& object : objects)
+    gpu_objects.push_back({
+        .instance {object.instance},
+        .bounds {object.bounds},
+        .index_count {object.mesh.index_count},
+        .first_index {object.mesh.first_index},
+        .vertex_offset {object.mesh.vertex_offset},
+    });
+  uploadBuffer(object_buf, vk::DeviceSize {object_count} * sizeof(GpuObject),
+      std::as_bytes(std::span {gpu_objects}));
+
+  const auto first {object_count};
+  object_count += static_cast<std::uint32_t>(objects.size());
+  return first;
+}
+
+void Renderer::submitObjects(DrawPush resources) {
+  object_draw = resources;
+}
+
+void Renderer::setViewProjection(const std::array<float, 16>& matrix) {
+  view_proj = matrix;
+
+  const auto row {[&](size_t r) {
+    return std::array {
+        matrix[r], matrix[4 + r], matrix[8 + r], matrix[12 + r]};
+  }};
+  const auto plane {[](const std::array<float, 4>& a,
+                        const std::array<float, 4>& b, float sign) {
+    std::array<float, 4> p;
+    for(size_t i {0}; i < p.size(); i++)
+      p[i] = a[i] + sign * b[i];
+    const float len {std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2])};
+    for(auto& v : p)
+      v /= len;
+    return p;
+  }};
+
+  const auto x {row(0)}, y {row(1)}, z {row(2)}, w {row(3)};
+  frustum = {
+      plane(w, x, 1.0f),
+      plane(w, x, -1.0f),
+      plane(w, y, 1.0f),
+      plane(w, y, -1.0f),
+      plane(z, z, 0.0f),
+      plane(w, z, -1.0f),
+  };
+}
+
+void Renderer::recordCull(vk::CommandBuffer cmd) {
+  const CullPush push {
+      .planes {frustum},
+      .object_count {object_count},
+      .objects {object_idx},
+      .visible {visible_idx},
+      .commands {indirect_idx},
+      .count {count_idx},
+  };
+  cmd.bindPipeline(vk::PipelineBindPoint::eCompute, cull_pipeline);
+  cmd.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute, cull_layout, 0, bindless_set, {});
+  cmd.pushConstants<CullPush>(
+      cull_layout, vk::ShaderStageFlagBits::eCompute, 0, push);
+  cmd.dispatch((object_count + 63) / 64, 1, 1);
+}
+
+void Renderer::recordObjects(vk::CommandBuffer cmd) {
+  if(!object_draw || !object_count)
+    return;
+
+  auto resources {*object_draw};
+  resources.buffer = visible_idx;
+  bindDrawState(cmd);
+  cmd.pushConstants<DrawPush>(layout,
+      vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+      0, resources);
+  cmd.drawIndexedIndirectCount(indirect_buf, 0, count_buf, 0, object_count,
+      sizeof(vk::DrawIndexedIndirectCommand));
+}
+
+void Renderer::createTimestampPool() {
+  const auto qfams {rend_group.dev.getQueueFamilyProperties()};
+  const auto valid_bits {qfams[rend_group.qfam_idx].timestampValidBits};
+  if(!valid_bits)
+    return;
+
+  timestamp_period = rend_group.dev.getProperties().limits.timestampPeriod;
+  timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+  timestamp_pool = dev.createQueryPool({
+      .queryType {vk::QueryType::eTimestamp},
+      .queryCount {static_cast<std::uint32_t>(2 * frames_in_flight)},
+  });
+}
+
+void Renderer::readTimestamps(size_t slot) {
+  if(!timestamp_pool || !frame_values[slot])
+    return;
+
+  const auto stamps {dev.getQueryPoolResults<std::uint64_t>(timestamp_pool,
+      static_cast<std::uint32_t>(2 * slot), 2, 2 * sizeof(std::uint64_t),
+      sizeof(std::uint64_t), vk::QueryResultFlagBits::e64)};
+  if(stamps.result != vk::Result::eSuccess)
+    return;
+
+  const auto ticks {(stamps.value[1] - stamps.value[0]) & timestamp_mask};
+  frame_timer.setGpuTime(frame_values[slot],
+      std::chrono::nanoseconds {
+          static_cast<std::int64_t>(ticks * timestamp_period)});
+}
+
+void Renderer::createRecordWorkers() {
+  if(!opts.record_threads)
+    return;
+
+  jobs = std::make_unique<JobSystem>(opts.record_threads);
+  worker_frames.resize(frames_in_flight);
+  for(auto& frame : worker_frames) {
+    frame.resize(jobs->threadCount());
+    for(auto& worker : frame)
+      worker.pool = dev.createCommandPool({
+          .flags {vk::CommandPoolCreateFlagBits::eTransient},
+          .queueFamilyIndex {rend_group.qfam_idx},
+      });
+  }
+}
+
+void Renderer::destroyRecordWorkers() {
+  if(jobs) {
+    jobs->destroy();
+    jobs.reset();
   }
+  for(auto& frame : worker_frames)
+    for(auto& worker : frame)
+      deletions.push(frame_count, [dev {dev}, pool {worker.pool}] {
+        dev.destroy(pool);
+      });
+  worker_frames.clear();
+}
+
+void Renderer::recordSecondaries(const RenderTarget& target) {
+  auto& frame {worker_frames[frame_idx]};
+  for(auto& worker : frame) {
+    dev.resetCommandPool(worker.pool);
+    worker.used = 0;
+  }
+
+  const vk::CommandBufferInheritanceRenderingInfoKHR inherit_rendering {
+      .colorAttachmentCount {
+          static_cast<std::uint32_t>(target.color_formats.size())},
+      .pColorAttachmentFormats {target.color_formats.data()},
+      .depthAttachmentFormat {target.depth_format},
+      .rasterizationSamples {vk::SampleCountFlagBits::e1},
+  };
+  const vk::CommandBufferInheritanceInfo inherit {
+      .pNext {target.render_pass ? nullptr : &inherit_rendering},
+      .renderPass {target.render_pass},
+      .subpass {0},
+      .framebuffer {target.framebuffer},
+  };
+  const std::span<const DrawCommand> draws {draw_list};
+  const size_t per_job {std::max<size_t>(opts.draws_per_job, 1)};
+  const size_t job_count {(draws.size() + per_job - 1) / per_job};
+
+  secondaries.resize(job_count);
+  record_jobs.clear();
+  for(size_t i {0}; i < job_count; i++)
+    record_jobs.push_back([&, i](size_t worker_idx) {
+      auto& worker {frame[worker_idx]};
+      if(worker.used == worker.cmds.size())
+        worker.cmds.push_back(dev.allocateCommandBuffers({
+            .commandPool {worker.pool},
+            .level {vk::CommandBufferLevel::eSecondary},
+            .commandBufferCount {1},
+        })[0]);
+
+      auto cmd {worker.cmds[worker.used++]};
+      cmd.begin({
+          .flags {vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                  vk::CommandBufferUsageFlagBits::eRenderPassContinue},
+          .pInheritanceInfo {&inherit},
+      });
+      const size_t first {i * per_job};
+      recordDraws(cmd,
+          draws.subspan(first, std::min(per_job, draws.size() - first)));
+      if(i + 1 == job_count)
+        recordObjects(cmd);
+      cmd.end();
+      secondaries[i] = cmd;
+    });
+  jobs->run(record_jobs);
+}
+
+void Renderer::createSyncPrimitives() {
+  const vk::SemaphoreTypeCreateInfo type_info {
+      .semaphoreType {vk::SemaphoreType::eTimeline},
+      .initialValue {0},
+  };
+  frame_timeline = dev.createSemaphore({.pNext {&type_info}});
 }
 
 } // namespace vg
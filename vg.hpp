@@ -1,23 +1,62 @@
 #ifndef VG_HPP
 #define VG_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #define VULKAN_HPP_NO_STRUCT_CONSTRUCTORS
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
 #include <vulkan/vulkan.hpp>
 
 #include <GLFW/glfw3.h>
 
+#ifndef VG_VALIDATION
+#define VG_VALIDATION 0
+#endif
+
 namespace vg {
 
+struct RunStats {
+  size_t frames {0};
+  std::chrono::nanoseconds wall {0};
+  std::chrono::nanoseconds cpu {0};
+
+  double utilization() const {
+    return wall.count() ? static_cast<double>(cpu.count()) / wall.count()
+                        : 0.0;
+  }
+};
+
 class Window {
 public:
   Window(const std::string& title, int width, int height);
 
-  void run_continuous(std::function<void()> f);
+  RunStats run_continuous(std::function<void()> f);
+  RunStats run_on_demand(std::function<void()> f);
+  RunStats run_paced(double fps, std::function<void()> f);
+  void requestRedraw();
   void destroy();
 
   operator GLFWwindow*() const {
@@ -25,7 +64,429 @@ public:
   }
 
 private:
+  struct State {
+    std::atomic<bool> dirty {true};
+  };
+
   GLFWwindow* m_window;
+  std::shared_ptr<State> state;
+
+  static void markDirty(GLFWwindow* window);
+};
+
+class JobSystem {
+public:
+  using Job = std::function<void(size_t worker)>;
+
+  JobSystem(size_t thread_count);
+  void destroy();
+
+  void run(std::span<Job> jobs);
+
+  size_t threadCount() const {
+    return workers.size();
+  }
+
+private:
+  struct Worker {
+    std::thread thread;
+    std::mutex mtx;
+    std::deque<Job*> queue;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::mutex mtx;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  std::atomic<size_t> queued {0};
+  size_t pending {0};
+  bool stopping {false};
+  std::exception_ptr error;
+
+  Job* pop(size_t idx);
+  void workerLoop(size_t idx);
+};
+
+struct GpuAllocation {
+  vk::DeviceMemory memory;
+  vk::DeviceSize offset {0};
+  vk::DeviceSize size {0};
+  std::uint8_t* mapped {nullptr};
+  std::uint32_t type_idx {0};
+  std::uint32_t pool_idx {UINT32_MAX};
+  std::uint32_t block_idx {0};
+  std::uint8_t order {0};
+};
+
+struct GpuHeapStats {
+  vk::DeviceSize heap_size {0};
+  vk::DeviceSize block_bytes {0};
+  vk::DeviceSize used_bytes {0};
+  vk::DeviceSize requested_bytes {0};
+  vk::DeviceSize largest_free {0};
+  size_t block_count {0};
+  size_t allocation_count {0};
+
+  double utilization() const {
+    return block_bytes ? static_cast<double>(used_bytes) / block_bytes : 0.0;
+  }
+
+  double fragmentation() const {
+    const auto free_bytes {block_bytes - used_bytes};
+    return free_bytes ? 1.0 - static_cast<double>(largest_free) / free_bytes
+                      : 0.0;
+  }
+};
+
+class GpuAllocator {
+public:
+  GpuAllocator() = default;
+  GpuAllocator(vk::PhysicalDevice phy_dev, vk::Device dev,
+      vk::DeviceSize block_size = 64 << 20);
+  void destroy();
+
+  GpuAllocation allocate(const vk::MemoryRequirements& reqs,
+      vk::MemoryPropertyFlags props, bool linear);
+  void free(const GpuAllocation& alloc);
+
+  std::pair<vk::Buffer, GpuAllocation> createBuffer(
+      const vk::BufferCreateInfo& info, vk::MemoryPropertyFlags props);
+  std::pair<vk::Image, GpuAllocation> createImage(
+      const vk::ImageCreateInfo& info, vk::MemoryPropertyFlags props);
+  void destroy(vk::Buffer buf, const GpuAllocation& alloc);
+  void destroy(vk::Image img, const GpuAllocation& alloc);
+
+  std::uint32_t findMemoryType(
+      std::uint32_t type_bits, vk::MemoryPropertyFlags props) const;
+  std::vector<GpuHeapStats> getStats() const;
+
+private:
+  static constexpr vk::DeviceSize min_size {256};
+
+  struct Block {
+    vk::DeviceMemory memory;
+    std::uint8_t* mapped {nullptr};
+    std::vector<std::set<vk::DeviceSize>> free_lists;
+  };
+
+  struct Pool {
+    std::uint32_t type_idx {0};
+    vk::DeviceSize block_size {0};
+    std::uint8_t max_order {0};
+    std::vector<Block> blocks;
+    vk::DeviceSize used {0};
+    vk::DeviceSize requested {0};
+    size_t allocation_count {0};
+  };
+
+  struct Dedicated {
+    vk::DeviceSize bytes {0};
+    size_t count {0};
+  };
+
+  vk::Device dev;
+  vk::PhysicalDeviceMemoryProperties mem_props;
+  vk::DeviceSize granularity {1};
+  std::vector<Pool> pools;
+  std::vector<Dedicated> dedicated;
+
+  vk::DeviceMemory allocateMemory(
+      std::uint32_t type_idx, vk::DeviceSize size, std::uint8_t** mapped);
+  std::uint32_t addBlock(Pool& pool);
+  std::optional<vk::DeviceSize> take(Block& block, std::uint8_t order);
+};
+
+class DeletionQueue {
+public:
+  using Deleter = std::function<void()>;
+
+  void push(std::uint64_t value, Deleter deleter);
+  void collect(std::uint64_t completed);
+  void flush();
+
+  size_t size() const {
+    return entries.size();
+  }
+
+private:
+  std::deque<std::pair<std::uint64_t, Deleter>> entries;
+};
+
+class StagingRing {
+public:
+  StagingRing() = default;
+  StagingRing(GpuAllocator& allocator, vk::DeviceSize size);
+  void destroy(GpuAllocator& allocator);
+
+  std::optional<vk::DeviceSize> allocate(
+      vk::DeviceSize size, vk::DeviceSize align);
+  void close(std::uint64_t batch);
+  void retire(std::uint64_t completed);
+
+  vk::Buffer getBuffer() const {
+    return buf;
+  }
+
+  std::uint8_t* getMapped(vk::DeviceSize offset) const {
+    return alloc.mapped + offset;
+  }
+
+  vk::DeviceSize capacity() const {
+    return alloc.size;
+  }
+
+private:
+  struct Region {
+    std::uint64_t batch;
+    vk::DeviceSize end;
+    vk::DeviceSize bytes;
+  };
+
+  vk::Buffer buf;
+  GpuAllocation alloc;
+  vk::DeviceSize head {0};
+  vk::DeviceSize tail {0};
+  vk::DeviceSize used {0};
+  vk::DeviceSize open_bytes {0};
+  std::deque<Region> regions;
+};
+
+struct Vertex {
+  std::array<float, 3> pos;
+  std::array<float, 3> color;
+  std::array<float, 2> uv;
+};
+
+struct Mesh {
+  std::uint32_t index_count {0};
+  std::uint32_t first_index {0};
+  std::int32_t vertex_offset {0};
+};
+
+struct Instance {
+  std::array<float, 16> transform {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+      0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+  std::array<float, 4> color {1.0f, 1.0f, 1.0f, 1.0f};
+};
+
+struct InstanceRange {
+  std::uint32_t first {0};
+  std::uint32_t count {0};
+};
+
+constexpr std::uint32_t no_resource {UINT32_MAX};
+
+enum class BindlessType : std::uint32_t {
+  eTexture,
+  eBuffer,
+  eSampler,
+};
+
+struct DrawPush {
+  std::uint32_t texture {no_resource};
+  std::uint32_t sampler {0};
+  std::uint32_t buffer {no_resource};
+};
+
+struct DrawCommand {
+  Mesh mesh;
+  std::uint32_t instance_count {1};
+  std::uint32_t first_instance {0};
+  DrawPush resources;
+};
+
+struct Object {
+  Mesh mesh;
+  Instance instance;
+  std::array<float, 4> bounds {0.0f, 0.0f, 0.0f, 1.0f};
+};
+
+struct FrameTiming {
+  std::uint64_t frame {0};
+  std::chrono::nanoseconds frame_time {0};
+  std::chrono::nanoseconds upload {0};
+  std::chrono::nanoseconds wait {0};
+  std::chrono::nanoseconds acquire {0};
+  std::chrono::nanoseconds record {0};
+  std::chrono::nanoseconds submit {0};
+  std::chrono::nanoseconds present {0};
+  std::chrono::nanoseconds cpu {0};
+  std::chrono::nanoseconds gpu {0};
+};
+
+class FrameTimer {
+public:
+  FrameTimer(size_t capacity = 1024);
+
+  void push(const FrameTiming& timing);
+  void setGpuTime(std::uint64_t frame, std::chrono::nanoseconds gpu);
+
+  size_t size() const {
+    return std::min(count, samples.size());
+  }
+
+  const FrameTiming& last() const {
+    assert(count > 0);
+    return samples[(count - 1) % samples.size()];
+  }
+
+  std::chrono::nanoseconds percentile(double p,
+      std::chrono::nanoseconds FrameTiming::*field =
+          &FrameTiming::frame_time) const;
+  void dumpCsv(std::ostream& os) const;
+
+private:
+  std::vector<FrameTiming> samples;
+  size_t count {0};
+};
+
+using GraphResource = std::uint32_t;
+
+struct GraphAccess {
+  vk::PipelineStageFlags stages;
+  vk::AccessFlags access;
+  vk::ImageLayout layout {vk::ImageLayout::eUndefined};
+};
+
+struct GraphImageDesc {
+  vk::Format format {vk::Format::eUndefined};
+  vk::Extent2D extent;
+  vk::ImageUsageFlags usage;
+  vk::ImageAspectFlags aspect {vk::ImageAspectFlagBits::eColor};
+
+  bool operator==(const GraphImageDesc&) const = default;
+};
+
+struct GraphAttachment {
+  GraphResource image;
+  vk::AttachmentLoadOp load_op {vk::AttachmentLoadOp::eClear};
+  vk::ClearValue clear {};
+};
+
+struct RenderTarget {
+  vk::RenderPass render_pass;
+  vk::Framebuffer framebuffer;
+  vk::Extent2D extent;
+  std::vector<vk::Format> color_formats;
+  vk::Format depth_format {vk::Format::eUndefined};
+};
+
+class RenderGraph {
+public:
+  using Use = std::pair<GraphResource, GraphAccess>;
+  using Record =
+      std::function<void(vk::CommandBuffer cmd, const RenderTarget& target)>;
+
+  RenderGraph() = default;
+  RenderGraph(vk::Device dev, GpuAllocator& allocator,
+      DeletionQueue& deletions, bool dynamic = false);
+  void destroy();
+
+  GraphResource importImage(vk::Image image, vk::ImageView view,
+      const GraphImageDesc& desc, const GraphAccess& initial,
+      const GraphAccess& final = {});
+  GraphResource importBuffer(vk::Buffer buf, const GraphAccess& initial = {},
+      const GraphAccess& final = {});
+  GraphResource createImage(const GraphImageDesc& desc);
+
+  void addPass(std::string name, std::vector<Use> uses, Record record);
+  void addRenderPass(std::string name, std::vector<GraphAttachment> colors,
+      std::optional<GraphAttachment> depth, std::vector<Use> uses,
+      vk::SubpassContents contents, Record record);
+  void timePass(std::string_view name, vk::QueryPool pool,
+      std::uint32_t first_query);
+
+  vk::RenderPass getRenderPass(std::span<const vk::Format> colors,
+      vk::Format depth = vk::Format::eUndefined);
+  void execute(vk::CommandBuffer cmd, std::uint64_t frame);
+  void reset();
+  void invalidate(std::uint64_t frame);
+
+  size_t getCulledPasses() const {
+    return culled;
+  }
+
+private:
+  struct State {
+    vk::PipelineStageFlags write_stages;
+    vk::AccessFlags write_access;
+    vk::PipelineStageFlags read_stages;
+    vk::AccessFlags read_access;
+    vk::ImageLayout layout {vk::ImageLayout::eUndefined};
+  };
+
+  struct Resource {
+    vk::Image image;
+    vk::ImageView view;
+    vk::Buffer buffer;
+    GraphImageDesc desc;
+    std::optional<std::uint32_t> transient;
+    State state;
+    GraphAccess final;
+  };
+
+  struct Pass {
+    std::string name;
+    std::vector<Use> uses;
+    std::vector<GraphAttachment> colors;
+    std::optional<GraphAttachment> depth;
+    vk::SubpassContents contents {vk::SubpassContents::eInline};
+    Record record;
+    bool graphics {false};
+    bool live {false};
+    vk::QueryPool timestamps;
+    std::uint32_t first_query {0};
+  };
+
+  struct Transient {
+    GraphImageDesc desc;
+    size_t first {0};
+    size_t last {0};
+    vk::Image image;
+    vk::ImageView view;
+    std::uint32_t slot {0};
+  };
+
+  struct Slot {
+    GpuAllocation alloc;
+    vk::PipelineStageFlags stages;
+    vk::PipelineStageFlags write_stages;
+    vk::AccessFlags write_access;
+  };
+
+  struct RenderPassKey {
+    std::vector<vk::Format> formats;
+    std::vector<vk::AttachmentLoadOp> load_ops;
+    std::vector<vk::AttachmentStoreOp> store_ops;
+    bool depth {false};
+
+    auto operator<=>(const RenderPassKey&) const = default;
+  };
+
+  using FramebufferKey = std::pair<vk::RenderPass, std::vector<vk::ImageView>>;
+
+  vk::Device dev;
+  GpuAllocator* allocator {nullptr};
+  DeletionQueue* deletions {nullptr};
+  bool dynamic {false};
+  std::vector<Resource> resources;
+  std::vector<Pass> passes;
+  std::vector<GraphImageDesc> transient_descs;
+  std::vector<Transient> transients;
+  std::vector<Slot> slots;
+  std::map<RenderPassKey, vk::RenderPass> render_passes;
+  std::map<FramebufferKey, vk::Framebuffer> framebuffers;
+  size_t culled {0};
+
+  void cull();
+  void allocateTransients(std::uint64_t frame);
+  void retireTransients(std::uint64_t frame);
+  void transition(vk::CommandBuffer cmd, std::span<const Use> uses);
+  vk::RenderPass createRenderPass(const RenderPassKey& key);
+  vk::AttachmentStoreOp storeOp(GraphResource image, size_t pass_idx) const;
+  RenderTarget beginRenderPass(vk::CommandBuffer cmd, size_t pass_idx);
+  RenderTarget beginRendering(vk::CommandBuffer cmd, size_t pass_idx);
+  void endRenderPass(vk::CommandBuffer cmd);
 };
 
 struct SurfaceDetails {
@@ -38,20 +499,163 @@ struct RenderGroup {
   vk::PhysicalDevice dev;
   std::uint32_t qfam_idx;
   SurfaceDetails surf_details;
+  std::uint32_t xfer_qfam_idx;
+};
+
+struct DispatchCost {
+  const char* call;
+  double trampoline_ns {0.0};
+  double direct_ns {0.0};
+};
+
+struct DeviceInfo {
+  vk::PhysicalDevice dev;
+  std::uint32_t index {0};
+  std::string name;
+  std::string uuid;
+  vk::PhysicalDeviceType type {vk::PhysicalDeviceType::eOther};
+  vk::DeviceSize vram {0};
+  std::uint32_t qfam_idx {0};
+  std::int64_t score {0};
+  std::string unsuitable;
+};
+
+std::vector<DeviceInfo> rankDevices(
+    vk::Instance inst, vk::SurfaceKHR surf = {});
+std::vector<DeviceInfo> listDevices();
+const DeviceInfo* matchDevice(
+    std::span<const DeviceInfo> devices, std::string_view selector);
+
+enum class LogSeverity {
+  eVerbose,
+  eInfo,
+  eWarning,
+  eError,
+};
+
+using Logger = std::function<void(LogSeverity, std::string_view)>;
+
+enum class PresentPolicy {
+  eLowLatency,
+  ePowerSaving,
+  eMaxThroughput,
+};
+
+std::string defaultPipelineCachePath();
+
+struct RendererOptions {
+  std::string pipeline_cache_path {defaultPipelineCachePath()};
+  size_t record_threads {std::thread::hardware_concurrency()};
+  size_t max_frames_in_flight {2};
+  size_t timing_history {1024};
+  size_t draws_per_job {256};
+  vk::DeviceSize vertex_buffer_size {64 << 20};
+  vk::DeviceSize index_buffer_size {32 << 20};
+  vk::DeviceSize instance_buffer_size {32 << 20};
+  std::uint32_t max_objects {65536};
+  vk::DeviceSize staging_size {16 << 20};
+  std::uint32_t bindless_textures {16384};
+  std::uint32_t bindless_buffers {16384};
+  std::uint32_t bindless_samplers {256};
+  bool dynamic_rendering {true};
+  PresentPolicy present_policy {PresentPolicy::eLowLatency};
+  bool validation {VG_VALIDATION};
+  Logger logger;
+  std::string device;
 };
 
 class Renderer {
 public:
-  Renderer(Window window);
+  Renderer(Window window, RendererOptions opts = {});
+  Renderer(vk::Extent2D extent, RendererOptions opts = {});
+  Renderer(const Renderer&) = delete;
+  Renderer& operator=(const Renderer&) = delete;
   void destroy();
 
+  Mesh createMesh(std::span<const Vertex> vertices,
+      std::span<const std::uint32_t> indices);
+  std::uint32_t createTexture(std::uint32_t width, std::uint32_t height,
+      std::span<const std::uint8_t> rgba);
+  void destroyTexture(std::uint32_t texture);
+
+  std::uint32_t registerTexture(vk::ImageView view);
+  std::uint32_t registerBuffer(vk::Buffer buf, vk::DeviceSize offset = 0,
+      vk::DeviceSize range = VK_WHOLE_SIZE);
+  std::uint32_t registerSampler(vk::Sampler sampler);
+  void releaseBindless(BindlessType type, std::uint32_t idx);
+
+  InstanceRange createInstances(std::span<const Instance> instances);
+
+  void submit(const DrawCommand& draw_cmd);
+  void submitInstanced(
+      const Mesh& mesh, InstanceRange instances, DrawPush resources = {});
+  std::uint32_t addObject(const Object& object);
+  std::uint32_t addObjects(std::span<const Object> objects);
+  void submitObjects(DrawPush resources = {});
+  void setViewProjection(const std::array<float, 16>& matrix);
+
   void draw();
+  std::vector<std::uint8_t> readPixels();
+
+  void setRecordThreads(size_t thread_count);
+  void setPresentPolicy(PresentPolicy policy);
+  std::vector<DispatchCost> measureDispatch(size_t calls);
+
+  std::optional<vk::PresentModeKHR> getPresentMode() const {
+    if(headless())
+      return std::nullopt;
+    return present_mode;
+  }
+
+  std::uint64_t getSubmittedFrame() const {
+    return frame_count;
+  }
+
+  size_t getFramesInFlight() const {
+    return frames_in_flight;
+  }
+
+  std::uint32_t getObjectCount() const {
+    return object_count;
+  }
+
+  std::uint64_t getCompletedFrame() const;
+  void waitFrame(std::uint64_t value) const;
+
+  std::vector<GpuHeapStats> getMemoryStats() const {
+    return allocator.getStats();
+  }
+
+  const FrameTimer& getFrameTimer() const {
+    return frame_timer;
+  }
+
+  vk::Extent2D getExtent() const {
+    return extent;
+  }
+
+  vk::Format getFormat() const {
+    return format.format;
+  }
+
+  bool usesDynamicRendering() const {
+    return dynamic_rendering;
+  }
 
 private:
-  Window window;
+  std::optional<Window> window;
+  RendererOptions opts;
+  size_t frames_in_flight;
   size_t frame_idx {0};
 
+  bool headless() const {
+    return !window;
+  }
+
+  void init();
+
   vk::Instance inst;
+  vk::DebugUtilsMessengerEXT messenger;
   void createInstance();
 
   vk::SurfaceKHR surf;
@@ -59,11 +663,80 @@ private:
 
   RenderGroup rend_group;
   void chooseRenderGroup();
+  void chooseTransferFamily();
 
   vk::Device dev;
+  bool dynamic_rendering {false};
   void createDevice();
+  bool supportsDynamicRendering() const;
+
+  GpuAllocator allocator;
+
+  vk::Buffer vertex_buf;
+  GpuAllocation vertex_alloc;
+  vk::DeviceSize vertex_used {0};
+  vk::Buffer index_buf;
+  GpuAllocation index_alloc;
+  vk::DeviceSize index_used {0};
+  vk::Buffer instance_buf;
+  GpuAllocation instance_alloc;
+  vk::DeviceSize instance_used {0};
+  std::uint32_t instance_idx {no_resource};
+  void createGeometryBuffers();
+  void destroyGeometryBuffers();
+
+  struct UploadBatch {
+    vk::CommandBuffer cmd;
+    std::uint64_t id {0};
+  };
+
+  StagingRing staging;
+  vk::CommandPool upload_pool;
+  vk::Semaphore upload_timeline;
+  std::optional<UploadBatch> upload_open;
+  std::deque<UploadBatch> upload_inflight;
+  std::vector<UploadBatch> upload_free;
+  std::uint64_t upload_next_id {1};
+  std::uint64_t upload_wait_value {0};
+  std::vector<vk::BufferMemoryBarrier> upload_regions;
+  std::vector<vk::ImageMemoryBarrier> upload_images;
+  std::vector<vk::BufferMemoryBarrier> pending_acquires;
+  std::vector<vk::ImageMemoryBarrier> pending_image_acquires;
+  void createUploadResources();
+  void destroyUploadResources();
+  vk::CommandBuffer beginUploads();
+  void uploadBuffer(vk::Buffer dst, vk::DeviceSize dst_offset,
+      std::span<const std::byte> data);
+  void uploadImage(vk::Image dst, vk::Extent2D size,
+      std::span<const std::byte> data);
+
+  struct BindlessSlots {
+    std::uint32_t capacity {0};
+    std::uint32_t next {0};
+    std::vector<std::uint32_t> free;
+    std::deque<std::pair<std::uint64_t, std::uint32_t>> retired;
+  };
+
+  struct Texture {
+    vk::Image image;
+    vk::ImageView view;
+    GpuAllocation alloc;
+  };
+
+  vk::DescriptorSetLayout bindless_layout;
+  vk::DescriptorPool bindless_pool;
+  vk::DescriptorSet bindless_set;
+  std::array<BindlessSlots, 3> bindless_slots;
+  vk::Sampler default_sampler;
+  std::unordered_map<std::uint32_t, Texture> textures;
+  void createBindless();
+  void destroyBindless();
+  std::uint32_t acquireBindless(BindlessType type);
+  void flushUploads();
+  void retireUploads(bool wait_oldest);
 
   vk::Queue gfx_q;
+  vk::Queue xfer_q;
 
   vk::SurfaceFormatKHR format;
   SurfaceDetails getSurfaceDetails(vk::PhysicalDevice dev);
@@ -76,37 +749,100 @@ private:
   void chooseSwapExtent();
 
   vk::SwapchainKHR swapchain;
-  vk::PresentModeKHR choosePresentMode();
-  void createSwapchain();
+  vk::PresentModeKHR present_mode {vk::PresentModeKHR::eFifo};
+  void choosePresentMode();
+  void createSwapchain(vk::SwapchainKHR old_swapchain = {});
 
-  void createSwapchainDependents();
+  void createSwapchainDependents(vk::SwapchainKHR old_swapchain = {});
   void destroySwapchainDependents();
   void recreateSwapchain();
 
   std::vector<vk::Image> images;
 
+  std::vector<GpuAllocation> image_allocs;
+  std::vector<vk::Buffer> readback_bufs;
+  std::vector<GpuAllocation> readback_allocs;
+  std::optional<std::uint32_t> last_img;
+  void createOffscreenImages();
+  void destroyOffscreenImages();
+
   std::vector<vk::ImageView> image_views;
   void createImageViews();
 
-  vk::RenderPass render_pass;
-  void createRenderPass();
+  DeletionQueue deletions;
+  RenderGraph graph;
+  vk::Format depth_format;
+  void chooseDepthFormat();
+
+  vk::PipelineCache pipeline_cache;
+  void createPipelineCache();
+  void savePipelineCache();
 
   vk::Pipeline pipeline;
   vk::PipelineLayout layout;
   void createPipeline();
 
-  std::vector<vk::Framebuffer> framebuffers;
-  void createFramebuffers();
-
-  vk::CommandPool cmd_pool;
-  std::vector<vk::CommandBuffer> cmd_bufs;
-
-  void recordCommandBuffers();
+  std::vector<vk::CommandPool> frame_pools;
+  std::vector<vk::CommandBuffer> frame_cmds;
+  void createFrameResources();
+  void recordCommandBuffer(vk::CommandBuffer cmd, std::uint32_t img_idx);
+  void bindDrawState(vk::CommandBuffer cmd);
+  void recordDraws(vk::CommandBuffer cmd, std::span<const DrawCommand> draws);
+
+  std::vector<DrawCommand> draw_list;
+
+  vk::Buffer object_buf;
+  GpuAllocation object_alloc;
+  vk::Buffer visible_buf;
+  GpuAllocation visible_alloc;
+  vk::Buffer indirect_buf;
+  GpuAllocation indirect_alloc;
+  vk::Buffer count_buf;
+  GpuAllocation count_alloc;
+  std::uint32_t object_count {0};
+  std::uint32_t object_idx {no_resource};
+  std::uint32_t visible_idx {no_resource};
+  std::uint32_t indirect_idx {no_resource};
+  std::uint32_t count_idx {no_resource};
+  std::optional<DrawPush> object_draw;
+  std::array<float, 16> view_proj {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+      0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+  std::array<std::array<float, 4>, 6> frustum;
+  vk::PipelineLayout cull_layout;
+  vk::Pipeline cull_pipeline;
+  void createCullResources();
+  void destroyCullResources();
+  void recordCull(vk::CommandBuffer cmd);
+  void recordObjects(vk::CommandBuffer cmd);
+
+  struct WorkerFrame {
+    vk::CommandPool pool;
+    std::vector<vk::CommandBuffer> cmds;
+    size_t used {0};
+  };
+
+  std::unique_ptr<JobSystem> jobs;
+  std::vector<std::vector<WorkerFrame>> worker_frames;
+  std::vector<JobSystem::Job> record_jobs;
+  std::vector<vk::CommandBuffer> secondaries;
+  void createRecordWorkers();
+  void destroyRecordWorkers();
+  void recordSecondaries(const RenderTarget& target);
 
   std::vector<vk::Semaphore> image_available;
   std::vector<vk::Semaphore> render_finished;
-  std::vector<vk::Fence> frame_inflight;
-  std::vector<vk::Fence> image_inflight;
+  FrameTimer frame_timer;
+  std::chrono::steady_clock::time_point last_draw_start;
+  vk::QueryPool timestamp_pool;
+  float timestamp_period {0.0f};
+  std::uint64_t timestamp_mask {0};
+  void createTimestampPool();
+  void readTimestamps(size_t slot);
+
+  vk::Semaphore frame_timeline;
+  std::uint64_t frame_count {0};
+  std::vector<std::uint64_t> frame_values;
+  std::vector<std::uint64_t> image_values;
   void createSyncPrimitives();
 };
 